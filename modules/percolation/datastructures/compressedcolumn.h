@@ -0,0 +1,240 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class RunLengthColumn
+    \brief Append-only column that stores each run of equal values once.
+
+    Meant for columns that are constant over long stretches,
+    e.g., the run id, the resolution level or whether the field percolates.
+    Random access is a binary search over the runs, a Cursor walks them in order.
+*/
+template <typename T>
+class RunLengthColumn {
+public:
+    using value_type = T;
+
+    void push_back(const T& value) {
+        if (Values.empty() || !(Values.back() == value)) {
+            Values.push_back(value);
+            RunEnds.push_back(NumRows);
+        }
+        RunEnds.back() = ++NumRows;
+    }
+
+    /// Appends all rows of another column.
+    void append(const RunLengthColumn& other) { appendRows(other, 0, other.size()); }
+
+    /// Appends the rows [begin, end) of another column, run by run.
+    void appendRows(const RunLengthColumn& other, const size_t begin, const size_t end) {
+        if (begin >= end) return;
+        size_t RunBegin = begin;
+        for (size_t run = other.findRun(begin); RunBegin < end; ++run) {
+            const size_t RunEnd = std::min(other.RunEnds[run], end);
+            if (Values.empty() || !(Values.back() == other.Values[run])) {
+                Values.push_back(other.Values[run]);
+                RunEnds.push_back(NumRows);
+            }
+            NumRows += RunEnd - RunBegin;
+            RunEnds.back() = NumRows;
+            RunBegin = RunEnd;
+        }
+    }
+
+    const T& operator[](const size_t row) const { return Values[findRun(row)]; }
+
+    /// Access in increasing or slowly decreasing row order, amortized constant time per row.
+    class Cursor {
+    public:
+        explicit Cursor(const RunLengthColumn& column) : Column(column) {}
+
+        const T& operator[](const size_t row) {
+            if (row < runBegin(Run)) {
+                Run = Column.findRun(row);
+            } else {
+                while (Column.RunEnds[Run] <= row) ++Run;
+            }
+            return Column.Values[Run];
+        }
+
+    private:
+        size_t runBegin(const size_t run) const { return run > 0 ? Column.RunEnds[run - 1] : 0; }
+
+        const RunLengthColumn& Column;
+        size_t Run = 0;
+    };
+
+    size_t size() const { return NumRows; }
+    bool empty() const { return NumRows == 0; }
+    void clear() {
+        Values.clear();
+        RunEnds.clear();
+        NumRows = 0;
+    }
+
+    size_t GetNumRuns() const { return Values.size(); }
+
+    /// Memory held by the runs, not counting heap memory of the values themselves
+    size_t GetNumBytes() const { return Values.size() * (sizeof(T) + sizeof(size_t)); }
+
+private:
+    size_t findRun(const size_t row) const {
+        return std::upper_bound(RunEnds.begin(), RunEnds.end(), row) - RunEnds.begin();
+    }
+
+    std::vector<T> Values;
+    /// One past the last row of each run
+    std::vector<size_t> RunEnds;
+    size_t NumRows = 0;
+};
+
+/** \class DeltaColumn
+    \brief Append-only integer column that stores differences to the previous row.
+
+    Differences are zigzag-mapped and written as variable-length bytes,
+    so slowly changing values, e.g., the number of components, take one byte per row.
+    Every BlockSize rows the full value is kept, random access decodes at most one block.
+    A Cursor decodes each block once when reading rows in order.
+*/
+template <typename T>
+class DeltaColumn {
+    static_assert(std::is_integral<T>::value, "Delta coding needs integer values.");
+
+public:
+    using value_type = T;
+    static constexpr size_t BlockSize = 64;
+
+    void push_back(const T value) {
+        if (NumRows % BlockSize == 0) {
+            BlockValues.push_back(value);
+            BlockOffsets.push_back(Bytes.size());
+        } else {
+            writeDelta(static_cast<std::int64_t>(value) - static_cast<std::int64_t>(Last));
+        }
+        Last = value;
+        NumRows++;
+    }
+
+    /// Appends all rows of another column. Whole blocks are copied if this column ends on a
+    /// block boundary, otherwise the rows are decoded once and encoded anew.
+    void append(const DeltaColumn& other) {
+        if (NumRows % BlockSize != 0) {
+            appendRows(other, 0, other.size());
+            return;
+        }
+        const size_t ByteOffset = Bytes.size();
+        BlockValues.insert(BlockValues.end(), other.BlockValues.begin(), other.BlockValues.end());
+        for (const size_t Offset : other.BlockOffsets)
+            BlockOffsets.push_back(ByteOffset + Offset);
+        Bytes.insert(Bytes.end(), other.Bytes.begin(), other.Bytes.end());
+        if (!other.empty()) Last = other.Last;
+        NumRows += other.NumRows;
+    }
+
+    /// Appends the rows [begin, end) of another column.
+    void appendRows(const DeltaColumn& other, const size_t begin, const size_t end) {
+        Cursor Rows(other);
+        for (size_t row = begin; row < end; ++row) push_back(Rows[row]);
+    }
+
+    T operator[](const size_t row) const {
+        const size_t Block = row / BlockSize;
+        std::int64_t Value = static_cast<std::int64_t>(BlockValues[Block]);
+        size_t Pos = BlockOffsets[Block];
+        for (size_t step = Block * BlockSize; step < row; ++step) Value += readDelta(Pos);
+        return static_cast<T>(Value);
+    }
+
+    /// Access in increasing row order, each block is decoded once.
+    class Cursor {
+    public:
+        explicit Cursor(const DeltaColumn& column) : Column(column) {}
+
+        T operator[](const size_t row) {
+            // Start over at the block of the row, unless it lies ahead in the current one.
+            if (row < Row || row / BlockSize != Row / BlockSize) {
+                const size_t Block = row / BlockSize;
+                Row = Block * BlockSize;
+                Value = static_cast<std::int64_t>(Column.BlockValues[Block]);
+                Pos = Column.BlockOffsets[Block];
+            }
+            for (; Row < row; ++Row) Value += Column.readDelta(Pos);
+            return static_cast<T>(Value);
+        }
+
+    private:
+        const DeltaColumn& Column;
+        /// Row that Value belongs to, and the position of its successor's difference
+        size_t Row = std::numeric_limits<size_t>::max();
+        std::int64_t Value = 0;
+        size_t Pos = 0;
+    };
+
+    size_t size() const { return NumRows; }
+    bool empty() const { return NumRows == 0; }
+    void clear() {
+        BlockValues.clear();
+        BlockOffsets.clear();
+        Bytes.clear();
+        NumRows = 0;
+    }
+
+    /// Reserves for the given number of rows, assuming one byte per difference.
+    void reserve(const size_t numRows) {
+        BlockValues.reserve((numRows + BlockSize - 1) / BlockSize);
+        BlockOffsets.reserve((numRows + BlockSize - 1) / BlockSize);
+        Bytes.reserve(numRows);
+    }
+
+    size_t GetNumBytes() const {
+        return BlockValues.size() * (sizeof(T) + sizeof(size_t)) + Bytes.size();
+    }
+
+private:
+    void writeDelta(const std::int64_t delta) {
+        // Zigzag: small magnitudes of either sign become small unsigned numbers.
+        std::uint64_t Bits = (static_cast<std::uint64_t>(delta) << 1) ^
+                             static_cast<std::uint64_t>(delta >> 63);
+        while (Bits >= 0x80) {
+            Bytes.push_back(static_cast<std::uint8_t>(Bits | 0x80));
+            Bits >>= 7;
+        }
+        Bytes.push_back(static_cast<std::uint8_t>(Bits));
+    }
+
+    std::int64_t readDelta(size_t& pos) const {
+        std::uint64_t Bits = 0;
+        for (int shift = 0;; shift += 7) {
+            const std::uint8_t Byte = Bytes[pos++];
+            Bits |= static_cast<std::uint64_t>(Byte & 0x7F) << shift;
+            if (!(Byte & 0x80)) break;
+        }
+        return static_cast<std::int64_t>(Bits >> 1) ^ -static_cast<std::int64_t>(Bits & 1);
+    }
+
+    std::vector<T> BlockValues;
+    std::vector<size_t> BlockOffsets;
+    std::vector<std::uint8_t> Bytes;
+    T Last = T(0);
+    size_t NumRows = 0;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,110 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class ConcurrentUnionFind
+    \brief Lock-free union-find over a fixed range of element ids.
+
+    MakeSet, Find and Union may be called from many threads at once.
+    Parents are atomics, linking a root is a single compare-and-swap.
+    Find halves the path with a CAS that is allowed to fail.
+
+    Roots are always linked below the root with the smaller id, so no cycles can form
+    and the result does not depend on the order of the unions.
+    Unlike IndexedUnionFind, Union(A, B) hence does not guarantee that B stays the
+    representative. Union reports which root got linked, so that callers can move
+    per-component data to the new representative.
+
+    The number of sets is a concurrent counter.
+*/
+template <typename TIndex>
+class ConcurrentUnionFind {
+public:
+    using IndexType = TIndex;
+
+    /// Marks an element that is not part of any set.
+    static constexpr TIndex None = std::numeric_limits<TIndex>::max();
+
+    explicit ConcurrentUnionFind(const std::uint64_t numElements)
+        : Parents(new std::atomic<TIndex>[numElements]), NumElements(numElements), NumSets(0) {
+        for (std::uint64_t id = 0; id < numElements; ++id)
+            Parents[id].store(None, std::memory_order_relaxed);
+    }
+
+    /// Representative of the set containing id, None if id is not in a set.
+    TIndex Find(TIndex id) const {
+        TIndex parent = Parents[id].load(std::memory_order_acquire);
+        if (parent == None) return None;
+
+        while (parent != id) {
+            TIndex grandParent = Parents[parent].load(std::memory_order_acquire);
+            // Path halving. Failing is fine, someone else shortened the path.
+            if (grandParent != parent) {
+                Parents[id].compare_exchange_weak(parent, grandParent, std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed);
+            }
+            id = grandParent;
+            parent = Parents[id].load(std::memory_order_acquire);
+        }
+        return id;
+    }
+
+    bool Contains(const TIndex id) const {
+        return Parents[id].load(std::memory_order_acquire) != None;
+    }
+
+    /// Puts id into a set of its own. Each id may only be made a set once.
+    void MakeSet(const TIndex id) {
+        Parents[id].store(id, std::memory_order_release);
+        NumSets.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Merges the sets of A and B. Both need to be in a set.
+    /// Returns the root that was linked below the other one, None if they were in the same set.
+    TIndex Union(const TIndex A, const TIndex B) {
+        while (true) {
+            TIndex RootA = Find(A);
+            TIndex RootB = Find(B);
+            if (RootA == RootB) return None;
+            if (RootA < RootB) std::swap(RootA, RootB);
+
+            // Link the larger root below the smaller one. Fails if RootA stopped being a root.
+            TIndex Expected = RootA;
+            if (Parents[RootA].compare_exchange_strong(Expected, RootB, std::memory_order_acq_rel,
+                                                       std::memory_order_relaxed)) {
+                NumSets.fetch_sub(1, std::memory_order_relaxed);
+                return RootA;
+            }
+        }
+    }
+
+    std::uint64_t GetNumSets() const { return NumSets.load(std::memory_order_relaxed); }
+
+    std::uint64_t GetNumElements() const { return NumElements; }
+
+private:
+    /// Atomics can neither be copied nor moved, so no std::vector.
+    std::unique_ptr<std::atomic<TIndex>[]> Parents;
+    std::uint64_t NumElements;
+    std::atomic<std::uint64_t> NumSets;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
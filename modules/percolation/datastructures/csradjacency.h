@@ -0,0 +1,148 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/connectivity/connectivity.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef __clang__
+#include <omp.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+
+using namespace discretedata;
+
+/** \class CSRAdjacency
+    \brief Neighborhood of all elements of one dimension, in compressed sparse row format.
+
+    Built once from Connectivity::getConnections.
+    The neighbors of element i are Neighbors[Offsets[i]] to Neighbors[Offsets[i+1] - 1].
+    Iterating them is a plain array walk, instead of a virtual call that
+    fills a vector for every element of an unstructured grid.
+*/
+class CSRAdjacency {
+public:
+    CSRAdjacency() = default;
+
+    /// Neighbors of elements of dimension elemDim, connected via elements of dimension elemDim.
+    CSRAdjacency(const Connectivity& grid, const GridPrimitive elemDim) : ElementDim(elemDim) {
+        const ind NumElements = grid.getNumElements(elemDim);
+        Offsets.assign(NumElements + 1, 0);
+
+        // Count, then fill. Each element queries its own neighbors, so both passes run parallel.
+#pragma omp parallel
+        {
+            std::vector<ind> Connections;
+#pragma omp for
+            for (ind id = 0; id < NumElements; ++id) {
+                grid.getConnections(Connections, id, elemDim, elemDim);
+                Offsets[id + 1] = static_cast<ind>(Connections.size());
+            }
+        }
+
+        for (ind id = 0; id < NumElements; ++id) Offsets[id + 1] += Offsets[id];
+        Neighbors.resize(Offsets[NumElements]);
+
+#pragma omp parallel
+        {
+            std::vector<ind> Connections;
+#pragma omp for
+            for (ind id = 0; id < NumElements; ++id) {
+                grid.getConnections(Connections, id, elemDim, elemDim);
+                std::copy(Connections.begin(), Connections.end(),
+                          Neighbors.begin() + Offsets[id]);
+            }
+        }
+    }
+
+    ind GetNumElements() const { return Offsets.empty() ? 0 : ind(Offsets.size()) - 1; }
+    GridPrimitive GetElementDim() const { return ElementDim; }
+
+    /// Range of the neighbors of one element
+    const ind* NeighborsBegin(const ind id) const { return Neighbors.data() + Offsets[id]; }
+    const ind* NeighborsEnd(const ind id) const { return Neighbors.data() + Offsets[id + 1]; }
+    ind GetNumNeighbors(const ind id) const { return Offsets[id + 1] - Offsets[id]; }
+
+    /// Memory held by the adjacency
+    size_t GetNumBytes() const {
+        return (Offsets.size() + Neighbors.size()) * sizeof(ind);
+    }
+
+private:
+    GridPrimitive ElementDim = GridPrimitive::Vertex;
+    std::vector<ind> Offsets;
+    std::vector<ind> Neighbors;
+};
+
+/** \class AdjacencyCache
+    \brief Keeps the CSR adjacency of the last few grids.
+
+    Keyed on the grid object and the element dimension.
+    Grids are held weakly, an entry is dropped once its grid is gone.
+    The same grid can be swept many times, e.g., with a different window or scalar channel,
+    so the adjacency is built only once.
+*/
+class AdjacencyCache {
+public:
+    explicit AdjacencyCache(const size_t maxEntries = 4) : MaxEntries(maxEntries) {}
+
+    /// Returns the adjacency of the given grid, building it if needed.
+    std::shared_ptr<const CSRAdjacency> Get(const std::shared_ptr<const Connectivity>& grid,
+                                            const GridPrimitive elemDim) {
+        if (!grid) return nullptr;
+
+        std::lock_guard<std::mutex> lock(Mutex);
+
+        // Remove expired grids, look for the given one.
+        for (auto it = Entries.begin(); it != Entries.end();) {
+            if (it->Grid.expired()) {
+                it = Entries.erase(it);
+                continue;
+            }
+            if (it->Grid.lock() == grid && it->ElementDim == elemDim) {
+                // Most recently used goes to the back.
+                Entry Hit = std::move(*it);
+                Entries.erase(it);
+                Entries.push_back(std::move(Hit));
+                return Entries.back().Adjacency;
+            }
+            ++it;
+        }
+
+        auto Adjacency = std::make_shared<const CSRAdjacency>(*grid, elemDim);
+        if (Entries.size() >= MaxEntries) Entries.erase(Entries.begin());
+        Entries.push_back({grid, elemDim, Adjacency});
+        return Adjacency;
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Entries.clear();
+    }
+
+private:
+    struct Entry {
+        std::weak_ptr<const Connectivity> Grid;
+        GridPrimitive ElementDim;
+        std::shared_ptr<const CSRAdjacency> Adjacency;
+    };
+
+    size_t MaxEntries;
+    std::vector<Entry> Entries;
+    std::mutex Mutex;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
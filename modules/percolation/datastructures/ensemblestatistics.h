@@ -0,0 +1,112 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class RunningStatistics
+    \brief Mean, variance, min and max of a stream of values, in constant memory.
+
+    Uses Welford's update, which stays accurate for many values of similar size,
+    unlike summing values and squares.
+*/
+class RunningStatistics {
+public:
+    void Add(const double value) {
+        Count++;
+        const double Delta = value - Mean;
+        Mean += Delta / static_cast<double>(Count);
+        M2 += Delta * (value - Mean);
+        Min = std::min(Min, value);
+        Max = std::max(Max, value);
+    }
+
+    size_t GetCount() const { return Count; }
+    double GetMean() const { return Mean; }
+    double GetMin() const { return Min; }
+    double GetMax() const { return Max; }
+
+    /// Unbiased sample variance, 0 for less than two values
+    double GetVariance() const { return (Count > 1) ? M2 / static_cast<double>(Count - 1) : 0.0; }
+    double GetStdDev() const { return std::sqrt(GetVariance()); }
+
+    /// Normal confidence interval of the mean, z = 1.96 gives 95%.
+    std::pair<double, double> GetConfidenceInterval(const double z = 1.96) const {
+        if (Count == 0) return {Mean, Mean};
+        const double HalfWidth = z * GetStdDev() / std::sqrt(static_cast<double>(Count));
+        return {Mean - HalfWidth, Mean + HalfWidth};
+    }
+
+private:
+    size_t Count = 0;
+    double Mean = 0;
+    double M2 = 0;
+    double Min = std::numeric_limits<double>::max();
+    double Max = std::numeric_limits<double>::lowest();
+};
+
+/** \class EnsembleStatistics
+    \brief Aggregates the curves of many runs, per sample index.
+
+    Each run adds NumQuantities values per sample index, e.g., the normalized volume
+    and whether the field percolates. Several series, e.g., one per scalar channel,
+    are kept apart. Memory is O(samples), independent of the number of runs.
+*/
+template <size_t NumQuantities>
+class EnsembleStatistics {
+public:
+    using Values = std::array<double, NumQuantities>;
+    using Sample = std::array<RunningStatistics, NumQuantities>;
+
+    void Clear() {
+        Series.clear();
+        NumRuns = 0;
+    }
+
+    /// Adds the values of the current run at one sample index of a series.
+    void Add(const std::string& series, const size_t sampleIdx, const Values& values) {
+        auto& Samples = Series[series];
+        if (Samples.size() <= sampleIdx) Samples.resize(sampleIdx + 1);
+        for (size_t quantity = 0; quantity < NumQuantities; ++quantity)
+            Samples[sampleIdx][quantity].Add(values[quantity]);
+    }
+
+    /// Counts a run whose samples have all been added.
+    void FinishRun() { NumRuns++; }
+
+    size_t GetNumRuns() const { return NumRuns; }
+
+    /// Total number of samples over all series
+    size_t GetNumSamples() const {
+        size_t NumSamples = 0;
+        for (const auto& Samples : Series) NumSamples += Samples.second.size();
+        return NumSamples;
+    }
+
+    const std::map<std::string, std::vector<Sample>>& GetSeries() const { return Series; }
+
+private:
+    std::map<std::string, std::vector<Sample>> Series;
+    size_t NumRuns = 0;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
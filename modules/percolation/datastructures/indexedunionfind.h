@@ -0,0 +1,110 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+
+/** \class IndexedUnionFind
+    \brief Union-find over a fixed range of element ids, templated on the index width.
+
+    Mirrors the interface of the combinatorial topology UnionFind,
+    but stores its parents with the given index type.
+    Using 32 bit indices halves the memory of the parent array for fields below 2^32 elements.
+
+    The parents are kept in TStorage, a std::vector by default. Any random-access container
+    with operator[] and size() works, e.g., a memory-mapped array for out-of-core runs.
+
+    Elements not (yet) in any set are reported as None.
+    Union(A, B) always attaches A to B, i.e., B remains the representative.
+    The sweep relies on that to keep its per-component statistics keyed by B.
+*/
+template <typename TIndex, typename TStorage = std::vector<TIndex>>
+class IndexedUnionFind {
+public:
+    using IndexType = TIndex;
+    using StorageType = TStorage;
+
+    /// Marks an element that is not part of any set.
+    static constexpr TIndex None = std::numeric_limits<TIndex>::max();
+
+    /// Largest number of elements that can be addressed with this index type.
+    static constexpr std::uint64_t MaxNumElements = static_cast<std::uint64_t>(None);
+
+    explicit IndexedUnionFind(const std::uint64_t numElements)
+        : Parents(numElements, None), NumSets(0) {}
+
+    /// Takes over the given parent storage and marks all elements as not being in a set.
+    explicit IndexedUnionFind(TStorage&& storage) : Parents(std::move(storage)), NumSets(0) {
+        const std::uint64_t numElements = Parents.size();
+        for (std::uint64_t id = 0; id < numElements; ++id) Parents[id] = None;
+    }
+
+    /// Returns the representative of the set containing the element, or None.
+    TIndex Find(TIndex id) const {
+        if (Parents[id] == None) return None;
+
+        // Path halving
+        while (Parents[id] != id) {
+            Parents[id] = Parents[Parents[id]];
+            id = Parents[id];
+        }
+        return id;
+    }
+
+    /// Whether the element is part of any set.
+    bool Contains(const TIndex id) const { return Parents[id] != None; }
+
+    /// Creates a new set only containing the element.
+    void MakeSet(const TIndex id) {
+        Parents[id] = id;
+        NumSets++;
+    }
+
+    /// Adds the element to the set with the given representative.
+    void ExtendSetByID(const TIndex setId, const TIndex id) { Parents[id] = setId; }
+
+    /// Attaches set A to set B. Both are expected to be representatives.
+    void Union(const TIndex setA, const TIndex setB) {
+        if (setA == setB) return;
+        Parents[setA] = setB;
+        NumSets--;
+    }
+
+    /// Hints the cache to fetch the parent of the element, which is about to be accessed.
+    void Prefetch(const TIndex id) const {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(&Parents[id], 1);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_prefetch(reinterpret_cast<const char*>(&Parents[id]), _MM_HINT_T0);
+#endif
+    }
+
+    std::uint64_t GetNumSets() const { return NumSets; }
+    std::uint64_t GetNumElements() const { return Parents.size(); }
+
+private:
+    /// Parent per element. Mutable for path halving in Find.
+    mutable TStorage Parents;
+    std::uint64_t NumSets;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,53 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <percolation/util/mappedfile.h>
+
+#include <type_traits>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class MappedArray
+    \brief Fixed-size array of trivially copyable elements living in a memory-mapped file.
+*/
+template <typename T>
+class MappedArray {
+public:
+    MappedArray() = default;
+
+    /// Maps an existing file holding elements of type T.
+    bool Open(const std::string& fileName, const bool writable = false,
+              const bool deleteOnClose = false) {
+        if (!File.Open(fileName, writable, deleteOnClose)) return false;
+        return File.GetSize() % sizeof(T) == 0;
+    }
+
+    /// Creates a scratch file for the given number of elements. Content is undefined.
+    bool Create(const std::string& fileName, const size_t numElements,
+                const bool deleteOnClose = true) {
+        return File.Create(fileName, numElements * sizeof(T), deleteOnClose);
+    }
+
+    T& operator[](const size_t idx) { return data()[idx]; }
+    const T& operator[](const size_t idx) const { return data()[idx]; }
+
+    T* data() { return reinterpret_cast<T*>(File.GetData()); }
+    const T* data() const { return reinterpret_cast<const T*>(File.GetData()); }
+    size_t size() const { return File.GetSize() / sizeof(T); }
+    bool IsOpen() const { return File.IsOpen(); }
+
+private:
+    MappedFile File;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
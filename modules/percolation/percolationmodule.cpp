@@ -10,6 +10,8 @@
 
 #include <percolation/percolationmodule.h>
 #include <percolation/processors/percolationanalysis.h>
+#include <percolation/processors/percolationcacheloader.h>
+#include <percolation/processors/percolationcachewriter.h>
 #include <percolation/processors/rawpercolationloader.h>
 #include <percolation/processors/scalartransform.h>
 #include <percolation/processors/shufflechannel.h>
@@ -27,6 +29,8 @@ PercolationModule::PercolationModule(InviwoApplication* app) : InviwoModule(app,
     // Processors
     // registerProcessor<PercolationProcessor>();
     registerProcessor<PercolationAnalysis>();
+    registerProcessor<PercolationCacheLoader>();
+    registerProcessor<PercolationCacheWriter>();
     registerProcessor<RawPercolationLoader>();
     registerProcessor<ScalarTransform>();
     registerProcessor<ShuffleChannel>();
@@ -9,12 +9,17 @@
  */
 
 #include <percolation/processors/percolationanalysis.h>
+#include <percolation/util/channelmetadata.h>
 
 #include <inviwo/core/util/filesystem.h>
 #include <modules/discretedata/connectivity/periodicgrid.h>
 #include <modules/discretedata/dataset.h>
 #include <modules/kxtools/performancetimer.h>
 
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+
 namespace inviwo {
 using namespace discretedata;
 
@@ -40,11 +45,22 @@ PercolationAnalysis::PercolationAnalysis()
                             return (a->getGridPrimitiveType() == GridPrimitive::Vertex &&
                                     a->getNumComponents() == 1);
                         })
+    , propFurtherScalars("furtherScalars", "Further Scalars (Comma-Separated)")
     , propVolumeChannel(portInData, "VolumeChannel", "Volume",
                         [](const std::shared_ptr<const Channel> a) {
                             return (a->getGridPrimitiveType() == GridPrimitive::Vertex &&
                                     a->getNumComponents() == 1);
                         })
+    , propMaskSource("maskSource", "Mask",
+                     {{"none", "None", percolation::MaskSource::None},
+                      {"nonFinite", "NaN and -Inf", percolation::MaskSource::NonFinite},
+                      {"channel", "Mask Channel", percolation::MaskSource::Channel}},
+                     0)
+    , propMaskChannel(portInData, "MaskChannel", "Mask Channel",
+                      [](const std::shared_ptr<const Channel> a) {
+                          return (a->getGridPrimitiveType() == GridPrimitive::Vertex &&
+                                  a->getNumComponents() == 1);
+                      })
     /// How to set H range
     , propMinMaxSettings("minMaxSettings", "Range of H")
     , propUsePercentage("usePercentage", "Percentage-based")
@@ -56,6 +72,8 @@ PercolationAnalysis::PercolationAnalysis()
     , propSampleSettings("sampleSettings", "Sampling of H")
     , propSampleType("sampleType", "Sampling Type")
     , propNumSamples("numSamples", "Num Samples", 100, 1, 10000000)
+    , propMaxTableRows("maxTableRows", "Max Table Rows", 0, 0, 10000000)
+    , propBatchPlateaus("batchPlateaus", "Batch Equal Values", false)
     , propPercDim("percDim", "Percolation Dimension",
                   {{"dimX", "X", PercolationDimension::X},
                    {"dimY", "Y", PercolationDimension::Y},
@@ -65,8 +83,37 @@ PercolationAnalysis::PercolationAnalysis()
 
     // Iteration
     , propIterationBtn("IterationBtn", "Iterate", InvalidationLevel::Valid)
+    , propAggregateRuns("aggregateRuns", "Aggregate Iterations", false)
     , propAlgorithmAnalysis("algorithmAnalysis", "Algorithm Analysis")
     , propPerformanceStatsFolderName("statFolder", "Statistics Folder")
+    , propOutOfCoreSettings("outOfCoreSettings", "Out-of-Core")
+    , propOutOfCore("outOfCore", "Out-of-Core Sweep", false)
+    , propScratchFolder("scratchFolder", "Scratch Folder")
+    , propOutOfCoreMemory("outOfCoreMemory", "Sort Memory (MB)", 1024, 16, 1024 * 1024)
+    , propProgressiveSettings("progressiveSettings", "Progressive Preview")
+    , propProgressive("progressive", "Progressive", false)
+    , propPreviewLevel("previewLevel", "Preview Resolution",
+                       {{"factor2", "1/2", 1}, {"factor4", "1/4", 2}}, 1)
+    , propPooling("pooling", "Pooling",
+                  {{"min", "Min", percolation::Pooling::Min},
+                   {"max", "Max", percolation::Pooling::Max},
+                   {"mean", "Mean", percolation::Pooling::Mean}},
+                  1)
+    , propEvaluationSettings("evaluationSettings", "Evaluation")
+    , propBackgroundEvaluation("backgroundEvaluation", "Background Evaluation", false)
+    , propPublishPartial("publishPartial", "Publish Partial Curves", false)
+    , propPartialInterval("partialInterval", "Partial Interval (s)", 2.0f, 0.1f, 60.0f, 0.1f)
+    , propConcurrentSweep("concurrentSweep", "Parallel Sweep", false)
+    , propVertexOrder("vertexOrder", "Vertex Order",
+                      {{"linear", "Linear", percolation::VertexOrder::Linear},
+                       {"bricked", "8^3 Bricks", percolation::VertexOrder::Bricked},
+                       {"morton", "8^3 Bricks, Morton", percolation::VertexOrder::Morton}},
+                      0)
+    , propProgress("progress", "Progress", 0.0f, 0.0f, 1.0f, 0.001f, InvalidationLevel::Valid)
+    , propSamplesEmitted("samplesEmitted", "Samples Emitted", 0, 0,
+                         std::numeric_limits<int>::max(), 1, InvalidationLevel::Valid)
+    , propETA("eta", "ETA (s)", 0.0f, -1.0f, std::numeric_limits<float>::max(), 0.1f,
+              InvalidationLevel::Valid)
 
     // Cluster Ids output
     , propClusterOutput("clusterOutput", "Cluster Output")
@@ -79,7 +126,11 @@ PercolationAnalysis::PercolationAnalysis()
     , propGlobalClusterPercentage("globalClusterPercentage", "Global Cluster Fraction", 0.0f, 0.0f,
                                   100.f, 0.1f)
     , propGlobalVoxelPercentage("globalVoxelPercentage", "Global Voxel Fraction", 0.0f, 0.0f, 100.f,
-                                0.1f) {
+                                0.1f)
+    , EvaluationGeneration(0)
+    , FirstRowOfRun(0)
+    , LastTimeSlice(-1)
+    , Lifetime(std::make_shared<int>(0)) {
 
     addPort(portInData);
     addPort(portOutTable);
@@ -87,7 +138,13 @@ PercolationAnalysis::PercolationAnalysis()
     addPort(portOutClusterStatistics);
 
     addProperty(propScalarChannel);
+    addProperty(propFurtherScalars);
     addProperty(propVolumeChannel);
+    addProperty(propMaskSource);
+    addProperty(propMaskChannel);
+    propMaskChannel.visibilityDependsOn(propMaskSource, [](auto& p) {
+        return p.get() == percolation::MaskSource::Channel;
+    });
 
     addProperty(propPerformanceStatsFolderName);
 
@@ -101,9 +158,12 @@ PercolationAnalysis::PercolationAnalysis()
     addProperty(propSampleSettings);
     propNumSamples.setSemantics(PropertySemantics::Text);
     propNumSamples.setCurrentStateAsDefault();
-    propSampleSettings.addProperties(propSampleType, propNumSamples);
+    propMaxTableRows.setSemantics(PropertySemantics::Text);
+    propSampleSettings.addProperties(propSampleType, propNumSamples, propBatchPlateaus,
+                                     propMaxTableRows);
     propSampleType.addOption("valueBased", "Value-Based", 0);
     propSampleType.addOption("voxelBased", "Voxel-Based", 1);
+    propSampleType.addOption("adaptive", "Adaptive", 2);
 
     propPerformanceStatsFolderName.setAcceptMode(AcceptMode::Open);
     propPerformanceStatsFolderName.setFileMode(FileMode::DirectoryOnly);
@@ -114,6 +174,7 @@ PercolationAnalysis::PercolationAnalysis()
             // Prepare for iteration
             RunID = 0;
             StatCache.clear();
+            Aggregate.Clear();
 
             propIterationBtn.setDisplayName("Iterating...  Press to Stop");
         } else {
@@ -123,7 +184,36 @@ PercolationAnalysis::PercolationAnalysis()
         }
     });
 
-    addProperties(propPercDim, propIterationBtn);
+    addProperties(propPercDim, propIterationBtn, propAggregateRuns);
+
+    // Out-of-core
+    addProperty(propOutOfCoreSettings);
+    propOutOfCoreSettings.addProperties(propOutOfCore, propScratchFolder, propOutOfCoreMemory);
+    propScratchFolder.setAcceptMode(AcceptMode::Open);
+    propScratchFolder.setFileMode(FileMode::DirectoryOnly);
+    propOutOfCoreMemory.setSemantics(PropertySemantics::Text);
+    propScratchFolder.visibilityDependsOn(propOutOfCore, [](auto& p) { return p.get(); });
+    propOutOfCoreMemory.visibilityDependsOn(propOutOfCore, [](auto& p) { return p.get(); });
+
+    // Progressive
+    addProperty(propProgressiveSettings);
+    propProgressiveSettings.addProperties(propProgressive, propPreviewLevel, propPooling);
+    propPreviewLevel.visibilityDependsOn(propProgressive, [](auto& p) { return p.get(); });
+    propPooling.visibilityDependsOn(propProgressive, [](auto& p) { return p.get(); });
+
+    // Background evaluation
+    addProperty(propEvaluationSettings);
+    propEvaluationSettings.addProperties(propBackgroundEvaluation, propPublishPartial,
+                                         propPartialInterval, propConcurrentSweep, propVertexOrder,
+                                         propProgress, propSamplesEmitted, propETA);
+    propPublishPartial.visibilityDependsOn(propBackgroundEvaluation,
+                                           [](auto& p) { return p.get(); });
+    propPartialInterval.visibilityDependsOn(propPublishPartial, [](auto& p) { return p.get(); });
+    propProgress.setReadOnly(true);
+    propSamplesEmitted.setReadOnly(true);
+    propETA.setReadOnly(true);
+    propSamplesEmitted.setSemantics(PropertySemantics::Text);
+    propETA.setSemantics(PropertySemantics::Text);
 
     addProperty(propAlgorithmAnalysis);
     propAlgorithmAnalysis.addProperties(propClusterOutput);
@@ -147,7 +237,21 @@ PercolationAnalysis::PercolationAnalysis()
     updateProperties();
 }
 
+PercolationAnalysis::~PercolationAnalysis() {
+    stopEvaluation();
+    Lifetime.reset();
+}
+
 void PercolationAnalysis::process() {
+    // Nothing changed: Publish what arrived from the background, if anything.
+    // The evaluation for these parameters is running or done, it is not started again.
+    if (!hasModifiedInput()) {
+        if (publishPendingResults() || CurrentProgress) return;
+    }
+
+    // Whatever is still running belongs to old parameters.
+    stopEvaluation();
+
     // Get data
     auto pInDataSet = portInData.getData();
     if (!pInDataSet || pInDataSet->getNumChannels() < 2) {
@@ -176,39 +280,667 @@ void PercolationAnalysis::process() {
         std::dynamic_pointer_cast<const DataChannel<double, 1>, const Channel>(InVolume);
     if (!Volume) return;
 
+    // The next time slice, e.g., from "Run Time Slices" in the loader, continues the table.
+    // Analysing the same or any other slice starts over, unless iterating.
+    const int TimeSlice = percolation::getTimeSlice(*Data);
+    const bool ContinuesTimeSlices = TimeSlice >= 0 && TimeSlice == LastTimeSlice + 1;
+    LastTimeSlice = TimeSlice;
+
     // Accumulate statistics?
     if (RunID < 0) {
-        // No, not iterating
-        StatCache.clear();
+        // No, not iterating. Keep the rows of the previous time slice, though.
+        if (ContinuesTimeSlices)
+            LogInfo("Appending time slice " << TimeSlice << " to the statistics.");
+        else
+            StatCache.clear();
     } else {
         // Yes, we are iterating
         RunID++;
     }
+    FirstRowOfRun = static_cast<ind>(StatCache.size());
+
+    // The selected scalar, and all further ones of the same size
+    const auto Scalars = getScalarChannels(*pInDataSet, Data);
+
+    SweepSettings Settings = gatherSweepSettings();
+    Settings.InDataSet = pInDataSet;
+    Settings.NormalizationVertices = Data->size();
+    Settings.TimeSlice = TimeSlice;
+
+    // Mask from a channel, one byte per vertex
+    if (Settings.MaskSource == percolation::MaskSource::Channel) {
+        auto MaskChannel = propMaskChannel.getCurrentChannel();
+        if (!MaskChannel || MaskChannel->getNumComponents() != 1 ||
+            MaskChannel->size() != Data->size()) {
+            LogWarn("Mask channel does not match the scalar. Not masking.");
+            Settings.MaskSource = percolation::MaskSource::None;
+        } else {
+            MaskChannel->dispatch<void, dispatching::filter::Scalars, 1, 1>(
+                [&](auto channel) { Settings.Mask = percolation::createVertexMask(*channel); });
+        }
+    }
+
+    const bool IsLattice = dynamic_cast<const StructuredGrid<3>*>(pInDataSet->getGrid().get());
+    if (!IsLattice) {
+        LogInfo("Percolation and component extents are only tracked on structured grids.");
+    }
+
+    bool Progressive = propProgressive.get();
+    if (Progressive && !IsLattice) {
+        LogWarn("Progressive preview needs a structured grid. Running at full resolution.");
+        Progressive = false;
+    }
+
+    // Iterating over loaded time slices: The loader passes on the next slice once this
+    // evaluation is done, which would cancel a sweep still running in the background.
+    if ((RunID >= 0 || ContinuesTimeSlices) && Settings.TimeSlice >= 0 &&
+        (Progressive || propBackgroundEvaluation.get())) {
+        LogInfo("Iterating over time slices. Running at full resolution in the foreground.");
+        Progressive = false;
+    } else if (Progressive || propBackgroundEvaluation.get()) {
+        startEvaluation(Scalars, Volume, pInDataSet->getGrid(), Settings, Progressive);
+        return;
+    }
 
     PerformanceTimer Timer;
 
-    Data->dispatch<void, dispatching::filter::Scalars, 1, 1>(
-        [&](auto channel) { this->processChannel(*channel, *Volume, *(pInDataSet->getGrid())); });
+    TStatCache RunStats;
+    ClusterResult Clusters;
+    Settings.Adjacency = getAdjacency(pInDataSet->getGrid(), Data->getGridPrimitiveType());
+    runSweeps(Scalars, *Volume, *(pInDataSet->getGrid()), Settings, propPooling.get(), RunStats,
+              Clusters);
 
     float timey = Timer.ElapsedTime();
     LogInfo("\tStatistic creation took " << timey << " seconds.");
 
+    recordRows(RunStats);
+    publishClusterResult(Clusters);
+    portOutTable.setData(createOutputTable(StatCache));
+
+    recordPerformance(*pInDataSet->getGrid(), timey);
+}
+
+void PercolationAnalysis::recordPerformance(const Connectivity& grid, const float seconds) const {
     // Record performance, if desired by user
-    if (filesystem::directoryExists(propPerformanceStatsFolderName.get())) {
-        // LogProcessorInfo("Dir exists.");
-        std::ofstream statFile;
-        statFile.open(propPerformanceStatsFolderName.get() + "Performance.csv",
-                      std::ios::out | std::ios::app);
-
-        if (statFile.is_open()) {
-            const auto* strucGrid =
-                dynamic_cast<const StructuredGrid<3>*>(pInDataSet->getGrid().get());
-            statFile << strucGrid->getNumVerticesInDimension(0) << ','
-                     << strucGrid->getNumVerticesInDimension(1) << ','
-                     << strucGrid->getNumVerticesInDimension(2) << ',' << timey << '\n';
-            statFile.close();
+    if (!filesystem::directoryExists(propPerformanceStatsFolderName.get())) return;
+
+    const auto* strucGrid = dynamic_cast<const StructuredGrid<3>*>(&grid);
+    if (!strucGrid) return;
+
+    std::ofstream statFile;
+    statFile.open(propPerformanceStatsFolderName.get() + "Performance.csv",
+                  std::ios::out | std::ios::app);
+
+    if (statFile.is_open()) {
+        statFile << strucGrid->getNumVerticesInDimension(0) << ','
+                 << strucGrid->getNumVerticesInDimension(1) << ','
+                 << strucGrid->getNumVerticesInDimension(2) << ',' << seconds << '\n';
+        statFile.close();
+    }
+}
+
+PercolationAnalysis::SweepSettings PercolationAnalysis::gatherSweepSettings() const {
+    SweepSettings Settings;
+    Settings.UsePercentage = propUsePercentage.get();
+    Settings.Percentage = propPercentage.get();
+    Settings.CutOffBothEnds = propCutOffBothEnds.get();
+    Settings.WindowStart = propWindowH.getStart();
+    Settings.WindowEnd = propWindowH.getEnd();
+    Settings.SampleType = propSampleType.get();
+    Settings.NumSamples = propNumSamples.get();
+    Settings.BatchPlateaus = propBatchPlateaus.get();
+    Settings.MaskSource = propMaskSource.get();
+    Settings.Mask = nullptr;
+    Settings.PercDim = propPercDim.getSelectedValue();
+
+    Settings.OutOfCore = propOutOfCore.get();
+    Settings.ScratchFolder = propScratchFolder.get();
+    Settings.OutOfCoreMemory = static_cast<size_t>(propOutOfCoreMemory.get());
+
+    Settings.ClusterStatsOutput = propClusterStatsOutput.get();
+    Settings.SampleIdClusters = propSampleIdClusters.get();
+    Settings.StopEarly = propStopEarly.get();
+    Settings.LocalGlobalStats = propLocalGlobalStats.get();
+    Settings.BlockSize = propBlockSize.get();
+
+    Settings.RunID = RunID;
+    Settings.ChannelName = "";
+    Settings.ResolutionLevel = 0;
+    Settings.TimeSlice = -1;
+    Settings.NormalizationVertices = 1;
+    Settings.ConcurrentSweep = propConcurrentSweep.get();
+    Settings.VertexOrder = propVertexOrder.get();
+    Settings.Progress = nullptr;
+    Settings.Adjacency = nullptr;
+    return Settings;
+}
+
+void PercolationAnalysis::appendSample(TStatCache& Stats, const SweepSettings& Settings,
+                                       const SampleWindow& Window, const double h,
+                                       const ind numComps, const double TotalVolume,
+                                       const double LargestVolume, const bool percolating) const {
+    Stats.RunID.push_back(static_cast<int>(Settings.RunID));
+    Stats.resolutionLevel.push_back(Settings.ResolutionLevel);
+    Stats.channelName.push_back(Settings.ChannelName);
+    Stats.timeSlice.push_back(Settings.TimeSlice);
+    Stats.statH.push_back(h);
+    double normH = 1.0 - (h - Window.MinVal) / (Window.MaxVal - Window.MinVal);
+    Stats.normalizedH.push_back(normH);
+    Stats.numComps.push_back((int)numComps);
+    double normVolume = (float)TotalVolume / Settings.NormalizationVertices;
+    Stats.normalizedCompVol.push_back(normVolume);
+    Stats.totalCompVol.push_back((float)TotalVolume);
+    Stats.largestCompVol.push_back((float)LargestVolume);
+    Stats.isPercolating.push_back(percolating ? 1 : 0);
+}
+
+void PercolationAnalysis::runSweep(const Channel& scalar, const DataChannel<double, 1>& volume,
+                                   const Connectivity& grid, const SweepSettings& Settings,
+                                   TStatCache& Stats, ClusterResult& Clusters) const {
+    scalar.dispatch<void, dispatching::filter::Scalars, 1, 1>([&](auto channel) {
+        this->processChannel(*channel, volume, grid, Settings, Stats, Clusters);
+    });
+}
+
+void PercolationAnalysis::runSweeps(const std::vector<std::shared_ptr<const Channel>>& scalars,
+                                    const DataChannel<double, 1>& volume,
+                                    const Connectivity& grid, const SweepSettings& Settings,
+                                    const percolation::Pooling pooling, TStatCache& Stats,
+                                    ClusterResult& Clusters) const {
+    const ind NumScalars = static_cast<ind>(scalars.size());
+    std::vector<TStatCache> ScalarStats(NumScalars);
+    std::vector<std::unique_ptr<SweepProgress>> Followers(NumScalars);
+
+    // Each scalar gets its share of the OpenMP threads.
+    int ThreadsPerScalar = 1;
+#ifndef __clang__
+    ThreadsPerScalar = std::max(1, omp_get_max_threads() / static_cast<int>(NumScalars));
+#endif
+
+    auto sweepScalar = [&](const ind idx) {
+        SweepSettings ScalarSettings = Settings;
+        ScalarSettings.ChannelName = scalars[idx]->getName();
+        ClusterResult NoClusters;
+        if (idx > 0) {
+            ScalarSettings.ClusterStatsOutput = false;
+            if (Settings.Progress) {
+                Followers[idx] = std::make_unique<SweepProgress>();
+                Followers[idx]->Parent = Settings.Progress;
+                ScalarSettings.Progress = Followers[idx].get();
+            }
+        }
+        ClusterResult& ScalarClusters = (idx == 0) ? Clusters : NoClusters;
+
+        if (Settings.ResolutionLevel == 0) {
+            runSweep(*scalars[idx], volume, grid, ScalarSettings, ScalarStats[idx],
+                     ScalarClusters);
+            return;
         }
+        const auto& lattice = dynamic_cast<const StructuredGrid<3>&>(grid);
+        scalars[idx]->dispatch<void, dispatching::filter::Scalars, 1, 1>([&](auto channel) {
+            this->sweepDownsampled(*channel, volume, lattice, pooling, ScalarSettings,
+                                   ScalarStats[idx]);
+        });
+    };
+
+    if (NumScalars == 1) {
+        sweepScalar(0);
+    } else {
+        // One thread per scalar. The thread count is per thread, so the caller keeps its own.
+        std::vector<std::future<void>> Jobs;
+        for (ind idx = 0; idx < NumScalars; ++idx) {
+            Jobs.push_back(std::async(std::launch::async, [&sweepScalar, ThreadsPerScalar, idx]() {
+#ifndef __clang__
+                omp_set_num_threads(ThreadsPerScalar);
+#endif
+                sweepScalar(idx);
+            }));
+        }
+        for (auto& Job : Jobs) Job.get();
     }
+
+    for (const auto& Rows : ScalarStats) Stats.append(Rows);
+}
+
+std::vector<std::shared_ptr<const Channel>> PercolationAnalysis::getScalarChannels(
+    const DataSet& dataSet, std::shared_ptr<const Channel> primary) const {
+    std::vector<std::shared_ptr<const Channel>> Scalars = {primary};
+
+    std::stringstream Names(propFurtherScalars.get());
+    std::string Name;
+    while (std::getline(Names, Name, ',')) {
+        const size_t First = Name.find_first_not_of(" \t");
+        if (First == std::string::npos) continue;
+        Name = Name.substr(First, Name.find_last_not_of(" \t") - First + 1);
+
+        auto Scalar = dataSet.getChannel(Name, GridPrimitive::Vertex);
+        if (!Scalar) {
+            LogWarn("Skipping further scalar '" << Name << "': No vertex channel of that name.");
+            continue;
+        }
+        if (Scalar->getNumComponents() != 1 || Scalar->size() != primary->size()) {
+            LogWarn("Skipping further scalar '"
+                    << Name << "': Not a scalar channel of the same size as the selected one.");
+            continue;
+        }
+        if (std::find(Scalars.begin(), Scalars.end(), Scalar) != Scalars.end()) continue;
+        Scalars.push_back(Scalar);
+    }
+    return Scalars;
+}
+
+void PercolationAnalysis::startEvaluation(std::vector<std::shared_ptr<const Channel>> scalars,
+                                          std::shared_ptr<const DataChannel<double, 1>> volume,
+                                          std::shared_ptr<const Connectivity> grid,
+                                          SweepSettings Settings, const bool progressive) {
+    const size_t Generation = ++EvaluationGeneration;
+    const percolation::Pooling Pooling = propPooling.get();
+    std::weak_ptr<int> Alive = Lifetime;
+
+    // Progress is polled by the sweep, and shown here on the main thread.
+    auto Progress = std::make_shared<SweepProgress>();
+    Progress->PublishPartial = propBackgroundEvaluation.get() && propPublishPartial.get();
+    Progress->PartialInterval =
+        std::chrono::milliseconds(static_cast<int>(propPartialInterval.get() * 1000.0f));
+    Progress->OnNotify = [this, Alive, Generation](bool newPartial) {
+        dispatchFront([this, Alive, Generation, newPartial]() {
+            if (Alive.expired() || EvaluationGeneration != Generation || !CurrentProgress) return;
+            updateProgressProperties(*CurrentProgress, false);
+            if (newPartial) invalidate(InvalidationLevel::InvalidOutput);
+        });
+    };
+    CurrentProgress = Progress;
+    Settings.Progress = Progress.get();
+
+    // Full resolution gives the cluster output, all other levels only the curve.
+    auto computeLevel = [this, scalars, volume, grid, Pooling, Settings, Progress,
+                         Generation](const int level) {
+        PendingResult Result;
+        Result.Generation = Generation;
+        Result.ResolutionLevel = level;
+        Progress->Reset(level);
+        PerformanceTimer Timer;
+
+        SweepSettings LevelSettings = Settings;
+        LevelSettings.ResolutionLevel = level;
+        if (level == 0)
+            LevelSettings.Adjacency = getAdjacency(grid, scalars[0]->getGridPrimitiveType());
+        runSweeps(scalars, *volume, *grid, LevelSettings, Pooling, Result.Stats, Result.Clusters);
+        Result.Seconds = Timer.ElapsedTime();
+        return Result;
+    };
+
+    // Coarsest preview right away.
+    int FirstLevel = 0;
+    if (progressive) {
+        const int CoarsestLevel = propPreviewLevel.get();
+        PerformanceTimer Timer;
+        PendingResult Preview = computeLevel(CoarsestLevel);
+        LogInfo("\tPreview at 1/" << (1 << CoarsestLevel) << " resolution took "
+                                  << Timer.ElapsedTime() << " seconds.");
+        recordRows(Preview.Stats);
+        portOutTable.setData(createOutputTable(StatCache));
+        FirstLevel = CoarsestLevel - 1;
+    }
+
+    // Everything else in the background, level by level.
+    EvaluationJob = dispatchPool([this, computeLevel, Progress, FirstLevel, Generation, Alive]() {
+        for (int level = FirstLevel; level >= 0; --level) {
+            if (Progress->Cancelled || EvaluationGeneration != Generation) return;
+            PendingResult Finished = computeLevel(level);
+            if (Progress->Cancelled || EvaluationGeneration != Generation) return;
+
+            {
+                std::lock_guard<std::mutex> lock(PendingMutex);
+                PendingResults.push_back(std::move(Finished));
+            }
+            dispatchFront([this, Generation, Alive]() {
+                if (Alive.expired() || EvaluationGeneration != Generation) return;
+                invalidate(InvalidationLevel::InvalidOutput);
+            });
+        }
+    });
+}
+
+std::shared_ptr<const percolation::CSRAdjacency> PercolationAnalysis::getAdjacency(
+    const std::shared_ptr<const Connectivity>& grid, const GridPrimitive elemDim) const {
+    if (!grid || dynamic_cast<const StructuredGrid<3>*>(grid.get())) return nullptr;
+
+    PerformanceTimer Timer;
+    auto Adjacency = Adjacencies.Get(grid, elemDim);
+    LogInfo("\tAdjacency of " << Adjacency->GetNumElements() << " elements ("
+                              << Adjacency->GetNumBytes() / (1024 * 1024) << " MB) ready after "
+                              << Timer.ElapsedTime() << " seconds.");
+    return Adjacency;
+}
+
+void PercolationAnalysis::stopEvaluation() {
+    if (CurrentProgress) CurrentProgress->Cancelled = true;
+    ++EvaluationGeneration;
+    if (EvaluationJob.valid()) EvaluationJob.wait();
+    EvaluationJob = std::future<void>();
+    CurrentProgress.reset();
+
+    std::lock_guard<std::mutex> lock(PendingMutex);
+    PendingResults.clear();
+}
+
+bool PercolationAnalysis::publishPendingResults() {
+    std::vector<PendingResult> Finished;
+    {
+        std::lock_guard<std::mutex> lock(PendingMutex);
+        Finished.swap(PendingResults);
+    }
+
+    // Partial rows of the level currently running. Outdated once that level finished.
+    TStatCache Partial;
+    bool HasPartial = false;
+    if (CurrentProgress) {
+        std::lock_guard<std::mutex> lock(CurrentProgress->PartialMutex);
+        if (CurrentProgress->HasPartial && Finished.empty()) {
+            Partial = std::move(CurrentProgress->Partial);
+            HasPartial = true;
+        }
+        CurrentProgress->Partial.clear();
+        CurrentProgress->HasPartial = false;
+    }
+
+    if (Finished.empty() && !HasPartial) return false;
+
+    auto InDataSet = portInData.getData();
+    for (const auto& Level : Finished) {
+        if (Level.Generation != EvaluationGeneration) continue;
+        recordRows(Level.Stats);
+        publishClusterResult(Level.Clusters);
+        if (Level.ResolutionLevel == 0 && InDataSet)
+            recordPerformance(*InDataSet->getGrid(), Level.Seconds);
+    }
+
+    // Done?
+    if (CurrentProgress && EvaluationJob.valid() &&
+        EvaluationJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        updateProgressProperties(*CurrentProgress, true);
+    }
+
+    if (HasPartial) {
+        TStatCache Shown = StatCache;
+        Shown.append(Partial);
+        portOutTable.setData(createOutputTable(Shown));
+    } else {
+        portOutTable.setData(createOutputTable(StatCache));
+    }
+    return true;
+}
+
+void PercolationAnalysis::updateProgressProperties(const SweepProgress& Progress,
+                                                   const bool finished) {
+    propProgress.set(finished ? 1.0f : Progress.GetFraction());
+    propSamplesEmitted.set(static_cast<int>(Progress.NumSamples));
+    propETA.set(finished ? 0.0f : Progress.GetETA());
+}
+
+bool PercolationAnalysis::hasModifiedInput() const {
+    if (portInData.isChanged()) return true;
+    for (const auto* property : getPropertiesRecursive()) {
+        // Read-only properties show results and progress, they are not parameters.
+        if (property->getReadOnly()) continue;
+        if (property->isModified()) return true;
+    }
+    return false;
+}
+
+void PercolationAnalysis::publishClusterResult(const ClusterResult& Clusters) {
+    if (!Clusters.Clusters) return;
+
+    portOutClusters.setData(Clusters.Clusters);
+    if (Clusters.Statistics) portOutClusterStatistics.setData(Clusters.Statistics);
+    propThresholdValue.set(Clusters.ThresholdValue);
+    if (Clusters.HasLocalGlobalStats) {
+        propGlobalClusterPercentage.set(Clusters.GlobalClusterPercentage);
+        propGlobalVoxelPercentage.set(Clusters.GlobalVoxelPercentage);
+    }
+}
+
+void PercolationAnalysis::recordRows(const TStatCache& Rows) {
+    if (!isAggregating()) {
+        StatCache.append(Rows);
+        return;
+    }
+
+    // One series per scalar, samples counted within each. Previews are not aggregated.
+    std::map<std::string, size_t> NextSample;
+    bool FullResolution = false;
+    TStatCache::Cursors Columns(Rows);
+    for (size_t i = 0; i < Rows.size(); ++i) {
+        if (Columns.resolutionLevel[i] != 0) continue;
+        FullResolution = true;
+        const std::string& ChannelName = Columns.channelName[i];
+        const double VolumeRatio =
+            (Rows.totalCompVol[i] > 0) ? Rows.largestCompVol[i] / Rows.totalCompVol[i] : 0.0;
+        Aggregate.Add(ChannelName, NextSample[ChannelName]++,
+                      {Rows.statH[i], Rows.normalizedH[i], Rows.normalizedCompVol[i],
+                       double(Columns.numComps[i]), VolumeRatio,
+                       double(Columns.isPercolating[i])});
+    }
+    if (FullResolution) Aggregate.FinishRun();
+}
+
+std::shared_ptr<DataFrame> PercolationAnalysis::createOutputTable(const TStatCache& Stats) const {
+    if (isAggregating()) return createAggregateTable();
+    return createStatisticsTable(Stats, FirstRowOfRun);
+}
+
+std::shared_ptr<DataFrame> PercolationAnalysis::createAggregateTable() const {
+    auto pOutTable = std::make_shared<DataFrame>();
+    const ind NumRows = static_cast<ind>(Aggregate.GetNumSamples());
+
+    auto pSample = pOutTable->addColumn<int>("Sample", NumRows);
+    auto& Sample = pSample->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    auto pNumRuns = pOutTable->addColumn<int>("Iterations", NumRows);
+    auto& NumRuns = pNumRuns->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+
+    // Six columns per quantity
+    const std::array<std::string, NumAggregated> Names = {
+        "H",
+        "Value Fraction",
+        "Normalized Volume",
+        "Number of connected components",
+        "Largest volume / Total volume",
+        "Percolation probability " + propPercDim.getSelectedDisplayName()};
+    const std::array<std::string, 6> Measures = {"Mean", "Std Dev", "Min",
+                                                 "Max",  "95% Lower", "95% Upper"};
+    std::vector<std::vector<float>*> Columns;
+    for (const auto& Name : Names) {
+        for (const auto& Measure : Measures) {
+            auto pColumn = pOutTable->addColumn<float>(Name + " " + Measure, NumRows);
+            Columns.push_back(
+                &pColumn->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer());
+        }
+    }
+
+    const bool HasChannels = !propFurtherScalars.get().empty();
+    auto pChannel = HasChannels ? pOutTable->addCategoricalColumn("Channel") : nullptr;
+
+    ind Row = 0;
+    for (const auto& Series : Aggregate.GetSeries()) {
+        for (size_t sampleIdx = 0; sampleIdx < Series.second.size(); ++sampleIdx, ++Row) {
+            const auto& Quantities = Series.second[sampleIdx];
+            Sample[Row] = static_cast<int>(sampleIdx);
+            NumRuns[Row] = static_cast<int>(Quantities[0].GetCount());
+            for (size_t quantity = 0; quantity < NumAggregated; ++quantity) {
+                const auto& Stat = Quantities[quantity];
+                const auto Band = Stat.GetConfidenceInterval();
+                auto** Column = &Columns[quantity * Measures.size()];
+                (*Column[0])[Row] = static_cast<float>(Stat.GetMean());
+                (*Column[1])[Row] = static_cast<float>(Stat.GetStdDev());
+                (*Column[2])[Row] = static_cast<float>(Stat.GetMin());
+                (*Column[3])[Row] = static_cast<float>(Stat.GetMax());
+                (*Column[4])[Row] = static_cast<float>(Band.first);
+                (*Column[5])[Row] = static_cast<float>(Band.second);
+            }
+            if (pChannel) pChannel->add(Series.first);
+        }
+    }
+
+    pOutTable->updateIndexBuffer();
+    return pOutTable;
+}
+
+std::vector<ind> PercolationAnalysis::selectTableRows(const TStatCache& Stats) const {
+    const ind NumStatsRows = static_cast<ind>(Stats.size());
+    const ind MaxRows = static_cast<ind>(propMaxTableRows.get());
+    std::vector<ind> Rows;
+    if (MaxRows <= 0 || NumStatsRows <= MaxRows) {
+        Rows.resize(NumStatsRows);
+        std::iota(Rows.begin(), Rows.end(), ind(0));
+        return Rows;
+    }
+
+    // Both rows around a step, so that a plot draws it at the right place.
+    TStatCache::Cursors Columns(Stats);
+    auto isStep = [&Columns](const ind i) {
+        return Columns.isPercolating[i] != Columns.isPercolating[i + 1] ||
+               Columns.RunID[i] != Columns.RunID[i + 1] ||
+               Columns.resolutionLevel[i] != Columns.resolutionLevel[i + 1] ||
+               Columns.channelName[i] != Columns.channelName[i + 1] ||
+               Columns.timeSlice[i] != Columns.timeSlice[i + 1];
+    };
+
+    const double Stride = static_cast<double>(NumStatsRows) / static_cast<double>(MaxRows);
+    double NextEven = 0;
+    bool StepBefore = false;
+    Rows.reserve(MaxRows);
+    for (ind i = 0; i < NumStatsRows; ++i) {
+        const bool Even = (i >= NextEven);
+        if (Even) NextEven += Stride;
+        const bool StepAfter = i + 1 < NumStatsRows && isStep(i);
+        if (Even || StepBefore || StepAfter || i == NumStatsRows - 1) Rows.push_back(i);
+        StepBefore = StepAfter;
+    }
+    return Rows;
+}
+
+std::shared_ptr<DataFrame> PercolationAnalysis::createStatisticsTable(
+    const TStatCache& Stats, const ind FirstRowOfRun) const {
+    // Prepare output data
+    auto pOutTable = std::make_shared<DataFrame>();
+    // - How many rows we have, and which of them go into the table
+    const ind NumStatsRows = (ind)Stats.statH.size();
+    const std::vector<ind> Rows = selectTableRows(Stats);
+    const ind NumTableRows = static_cast<ind>(Rows.size());
+
+    // Add columns
+    auto pIterID = pOutTable->addColumn<int>("Iteration", NumTableRows);
+    auto& IterID = pIterID->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatH = pOutTable->addColumn<float>("H", NumTableRows);
+    auto& StatH = pStatH->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pNormalizedH = pOutTable->addColumn<float>("Value Fraction", NumTableRows);
+    auto& NormalizedH =
+        pNormalizedH->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatNormVol = pOutTable->addColumn<float>("Normalized Volume", NumTableRows);
+    auto& NormVol =
+        pStatNormVol->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatNumComp = pOutTable->addColumn<int>("Number of connected components", NumTableRows);
+    auto& AllComp =
+        pStatNumComp->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatMaxComp =
+        pOutTable->addColumn<int>("Maximum number of connected components", NumTableRows);
+    auto& MaxComp =
+        pStatMaxComp->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatNumCompRatio = pOutTable->addColumn<float>(
+        "Number of connected components / Maximum number of connected components", NumTableRows);
+    auto& CompRatio =
+        pStatNumCompRatio->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatLargestCompVol =
+        pOutTable->addColumn<float>("Volume largest connected component", NumTableRows);
+    auto& VolLargest =
+        pStatLargestCompVol->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatTotalVol = pOutTable->addColumn<float>("Total Volume", NumTableRows);
+    auto& VolTotal =
+        pStatTotalVol->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+    // --
+    auto pStatVolumeRatio =
+        pOutTable->addColumn<float>("Largest volume / Total volume", NumTableRows);
+    auto& VolRatio =
+        pStatVolumeRatio->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+
+    // --
+    auto pIsPercolating = pOutTable->addColumn<int>(
+        "Is percolating " + propPercDim.getSelectedDisplayName(), NumTableRows);
+    auto& PercolatingState =
+        pIsPercolating->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+
+    // Fill table
+    if (NumStatsRows > 0) {
+        // Maximal number of components in the current run, per scalar and overall
+        std::map<std::string, int> MaxNumComponents;
+        int MaxNumRunComponents = 0;
+        TStatCache::Cursors RunColumns(Stats);
+        for (ind i = std::min(FirstRowOfRun, NumStatsRows - 1); i < NumStatsRows; i++) {
+            const int NumComps = RunColumns.numComps[i];
+            int& Max = MaxNumComponents[RunColumns.channelName[i]];
+            Max = std::max(Max, NumComps);
+            MaxNumRunComponents = std::max(MaxNumRunComponents, NumComps);
+        }
+
+        TStatCache::Cursors Columns(Stats);
+        for (ind row(0); row < NumTableRows; row++) {
+            const ind i = Rows[row];
+            const auto itMax = MaxNumComponents.find(Columns.channelName[i]);
+            const int MaxNumConnectedComponents =
+                (itMax != MaxNumComponents.end()) ? itMax->second : MaxNumRunComponents;
+            const int NumComps = Columns.numComps[i];
+            IterID[row] = Columns.RunID[i];
+            StatH[row] = Stats.statH[i];
+            NormalizedH[row] = Stats.normalizedH[i];
+            NormVol[row] = Stats.normalizedCompVol[i];
+            AllComp[row] = NumComps;
+            CompRatio[row] = float(NumComps) / float(MaxNumConnectedComponents);
+            MaxComp[row] = MaxNumConnectedComponents;
+            VolLargest[row] = Stats.largestCompVol[i];
+            VolTotal[row] = Stats.totalCompVol[i];
+            VolRatio[row] = Stats.largestCompVol[i] / Stats.totalCompVol[i];
+            PercolatingState[row] = Columns.isPercolating[i];
+        }
+    }
+
+    // Only with progressive previews, keep the table unchanged otherwise.
+    if (propProgressive.get()) {
+        auto pResolution = pOutTable->addColumn<int>("Resolution Level", NumTableRows);
+        auto& Resolution =
+            pResolution->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+        TStatCache::Cursors Columns(Stats);
+        for (ind row(0); row < NumTableRows; row++)
+            Resolution[row] = Columns.resolutionLevel[Rows[row]];
+    }
+
+    // Only with further scalars, keep the table unchanged otherwise.
+    if (!propFurtherScalars.get().empty()) {
+        auto pChannel = pOutTable->addCategoricalColumn("Channel");
+        TStatCache::Cursors Columns(Stats);
+        for (const ind i : Rows) pChannel->add(Columns.channelName[i]);
+    }
+
+    // Only for loaded time slices, keep the table unchanged otherwise.
+    TStatCache::Cursors Columns(Stats);
+    if (std::any_of(Rows.begin(), Rows.end(),
+                    [&Columns](const ind i) { return Columns.timeSlice[i] >= 0; })) {
+        auto pTimeSlice = pOutTable->addColumn<int>("Time Slice", NumTableRows);
+        auto& TimeSlice =
+            pTimeSlice->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
+        for (ind row(0); row < NumTableRows; row++) TimeSlice[row] = Columns.timeSlice[Rows[row]];
+    }
+
+    pOutTable->updateIndexBuffer();
+    return pOutTable;
 }
 
 }  // namespace inviwo
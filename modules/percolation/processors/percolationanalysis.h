@@ -18,18 +18,43 @@
 #include <inviwo/core/properties/boolproperty.h>
 #include <inviwo/core/properties/compositeproperty.h>
 #include <inviwo/core/properties/minmaxproperty.h>
+#include <inviwo/core/properties/stringproperty.h>
 #include <inviwo/core/properties/transferfunctionproperty.h>
 #include <percolation/percolationmoduledefine.h>
 
-#include <combinatorialtopology/unionfind.h>
 #include <inviwo/core/ports/dataoutport.h>
 #include <modules/discretedata/ports/datasetport.h>
 #include <modules/discretedata/properties/datachannelproperty.h>
 #include <modules/discretedata/connectivity/structuredgrid.h>
+#include <modules/discretedata/connectivity/periodicgrid.h>
 #include <inviwo/dataframe/datastructures/dataframe.h>
-
+#include <percolation/util/channelaccess.h>
+#include <percolation/datastructures/indexedunionfind.h>
+#include <percolation/datastructures/csradjacency.h>
+#include <percolation/datastructures/compressedcolumn.h>
+#include <percolation/datastructures/concurrentunionfind.h>
+#include <percolation/datastructures/ensemblestatistics.h>
+#include <percolation/datastructures/mappedarray.h>
+#include <percolation/util/externalsort.h>
+#include <percolation/util/downsampling.h>
+#include <percolation/util/vertexorder.h>
+#include <percolation/util/countingsort.h>
+#include <percolation/util/vertexmask.h>
+#include <percolation/util/sortedorder.h>
+#include <modules/kxtools/performancetimer.h>
+#include <inviwo/core/util/filesystem.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <random>
 
+#ifndef __clang__
+#include <omp.h>
+#endif
+
 namespace inviwo {
 using namespace discretedata;
 
@@ -40,16 +65,20 @@ class IVW_MODULE_PERCOLATION_API PercolationAnalysis : public Processor {
     // Friends
     // Types
 public:
-    /// Holds some infos between runs
+    /// Holds some infos between runs.
+    /// Columns that are step functions over the samples are run-length or delta coded.
     struct TStatCache {
         std::vector<float> largestCompVol;
         std::vector<float> totalCompVol;
         std::vector<float> normalizedCompVol;
-        std::vector<int> numComps;
+        percolation::DeltaColumn<int> numComps;
         std::vector<float> statH;
         std::vector<float> normalizedH;
-        std::vector<int> RunID;
-        std::vector<int> isPercolating;
+        percolation::RunLengthColumn<int> RunID;
+        percolation::RunLengthColumn<int> isPercolating;
+        percolation::RunLengthColumn<int> resolutionLevel;
+        percolation::RunLengthColumn<std::string> channelName;
+        percolation::RunLengthColumn<int> timeSlice;
         void clear() {
             largestCompVol.clear();
             totalCompVol.clear();
@@ -59,15 +88,230 @@ public:
             normalizedH.clear();
             isPercolating.clear();
             RunID.clear();
+            resolutionLevel.clear();
+            channelName.clear();
+            timeSlice.clear();
+        }
+        size_t size() const { return statH.size(); }
+        void reserve(const size_t numRows) {
+            largestCompVol.reserve(numRows);
+            totalCompVol.reserve(numRows);
+            normalizedCompVol.reserve(numRows);
+            numComps.reserve(numRows);
+            statH.reserve(numRows);
+            normalizedH.reserve(numRows);
+        }
+        void append(const TStatCache& other) {
+            auto appendVec = [](auto& to, const auto& from) {
+                to.insert(to.end(), from.cbegin(), from.cend());
+            };
+            appendVec(largestCompVol, other.largestCompVol);
+            appendVec(totalCompVol, other.totalCompVol);
+            appendVec(normalizedCompVol, other.normalizedCompVol);
+            numComps.append(other.numComps);
+            appendVec(statH, other.statH);
+            appendVec(normalizedH, other.normalizedH);
+            RunID.append(other.RunID);
+            isPercolating.append(other.isPercolating);
+            resolutionLevel.append(other.resolutionLevel);
+            channelName.append(other.channelName);
+            timeSlice.append(other.timeSlice);
         }
+        /// Appends the rows [begin, end) of another cache.
+        void appendRows(const TStatCache& other, const size_t begin, const size_t end) {
+            auto appendVec = [begin, end](auto& to, const auto& from) {
+                to.insert(to.end(), from.cbegin() + begin, from.cbegin() + end);
+            };
+            appendVec(largestCompVol, other.largestCompVol);
+            appendVec(totalCompVol, other.totalCompVol);
+            appendVec(normalizedCompVol, other.normalizedCompVol);
+            numComps.appendRows(other.numComps, begin, end);
+            appendVec(statH, other.statH);
+            appendVec(normalizedH, other.normalizedH);
+            RunID.appendRows(other.RunID, begin, end);
+            isPercolating.appendRows(other.isPercolating, begin, end);
+            resolutionLevel.appendRows(other.resolutionLevel, begin, end);
+            channelName.appendRows(other.channelName, begin, end);
+            timeSlice.appendRows(other.timeSlice, begin, end);
+        }
+
+        /// Sequential access to the compressed columns, for reading rows in order.
+        struct Cursors {
+            explicit Cursors(const TStatCache& stats)
+                : numComps(stats.numComps)
+                , RunID(stats.RunID)
+                , isPercolating(stats.isPercolating)
+                , resolutionLevel(stats.resolutionLevel)
+                , channelName(stats.channelName)
+                , timeSlice(stats.timeSlice) {}
+            percolation::DeltaColumn<int>::Cursor numComps;
+            percolation::RunLengthColumn<int>::Cursor RunID;
+            percolation::RunLengthColumn<int>::Cursor isPercolating;
+            percolation::RunLengthColumn<int>::Cursor resolutionLevel;
+            percolation::RunLengthColumn<std::string>::Cursor channelName;
+            percolation::RunLengthColumn<int>::Cursor timeSlice;
+        };
     };
 
     enum PercolationDimension { X, Y, Z, ANY, ALL };
 
+    /// Shared between a sweep running on a worker and the processor.
+    /// The sweep reports how far it got, the processor may cancel it.
+    struct SweepProgress {
+        using Clock = std::chrono::steady_clock;
+
+        /// Set by the processor, polled by the sweep.
+        std::atomic<bool> Cancelled{false};
+        /// Progress of the primary channel, when sweeping several channels at once.
+        /// Cancelling it cancels this one too.
+        const SweepProgress* Parent = nullptr;
+        /// Vertices swept and to be swept in the current level
+        std::atomic<ind> NumSwept{0};
+        std::atomic<ind> NumToSweep{0};
+        /// Rows recorded in the current level
+        std::atomic<ind> NumSamples{0};
+        /// Level currently being swept
+        std::atomic<int> ResolutionLevel{0};
+        Clock::time_point StartTime = Clock::now();
+
+        /// Copy the recorded rows for intermediate display, at most every PartialInterval.
+        bool PublishPartial = false;
+        std::chrono::milliseconds PartialInterval{1000};
+        /// Minimal time between two notifications
+        std::chrono::milliseconds NotifyInterval{250};
+
+        /// Called on the worker thread, at most every NotifyInterval.
+        /// The argument tells whether a new partial copy is available.
+        std::function<void(bool)> OnNotify;
+
+        /// Latest copy of the rows of the current level, guarded by PartialMutex.
+        std::mutex PartialMutex;
+        TStatCache Partial;
+        bool HasPartial = false;
+
+        /// Starts a new level
+        void Reset(const int level) {
+            NumSwept = 0;
+            NumToSweep = 0;
+            NumSamples = 0;
+            ResolutionLevel = level;
+            StartTime = Clock::now();
+            LastNotify = StartTime;
+            LastPartial = StartTime;
+        }
+
+        /// Called by the sweep every few thousand vertices.
+        void Report(const ind swept, const ind toSweep, const TStatCache& Stats) {
+            NumSwept = swept;
+            NumToSweep = toSweep;
+            NumSamples = static_cast<ind>(Stats.size());
+
+            const auto Now = Clock::now();
+            if (Now - LastNotify < NotifyInterval) return;
+            LastNotify = Now;
+
+            bool NewPartial = false;
+            if (PublishPartial && Now - LastPartial >= PartialInterval) {
+                std::lock_guard<std::mutex> lock(PartialMutex);
+                Partial = Stats;
+                HasPartial = true;
+                LastPartial = Now;
+                NewPartial = true;
+            }
+            if (OnNotify) OnNotify(NewPartial);
+        }
+
+        bool IsCancelled() const { return Cancelled || (Parent && Parent->IsCancelled()); }
+
+        /// Fraction of the current level done
+        float GetFraction() const {
+            const ind toSweep = NumToSweep;
+            return toSweep > 0 ? static_cast<float>(NumSwept) / static_cast<float>(toSweep) : 0.0f;
+        }
+
+        /// Estimated seconds until the current level is done, negative if unknown
+        float GetETA() const {
+            const float Fraction = GetFraction();
+            if (Fraction <= 0) return -1.0f;
+            const float Elapsed =
+                std::chrono::duration<float>(Clock::now() - StartTime).count();
+            return Elapsed * (1.0f - Fraction) / Fraction;
+        }
+
+    private:
+        Clock::time_point LastNotify;
+        Clock::time_point LastPartial;
+    };
+
+    /// Property values needed by the sweep, gathered once on the main thread.
+    /// The sweep only reads these, so it can run on any thread.
+    struct SweepSettings {
+        bool UsePercentage;
+        float Percentage;
+        bool CutOffBothEnds;
+        float WindowStart;
+        float WindowEnd;
+        int SampleType;
+        ind NumSamples;
+        PercolationDimension PercDim;
+
+        bool OutOfCore;
+        std::string ScratchFolder;
+        size_t OutOfCoreMemory;
+
+        bool ClusterStatsOutput;
+        size_t SampleIdClusters;
+        bool StopEarly;
+        bool LocalGlobalStats;
+        size3_t BlockSize;
+        /// Dataset the cluster channels are added to
+        std::shared_ptr<const DataSet> InDataSet;
+
+        ind RunID;
+        /// Name of the scalar channel, recorded with every row
+        std::string ChannelName;
+        /// Downsampling level the sweep runs on, 0 is full resolution
+        int ResolutionLevel;
+        /// Time slice the scalar was loaded from, recorded with every row. -1 if not known.
+        int TimeSlice;
+        /// Number of full resolution vertices, used to normalize the volume
+        ind NormalizationVertices;
+
+        /// Record one voxel-based sample per plateau of equal values
+        bool BatchPlateaus;
+
+        /// Vertices excluded from the sweep
+        percolation::MaskSource MaskSource;
+        /// Mask read from a channel, for MaskSource::Channel
+        std::shared_ptr<const percolation::VertexMask> Mask;
+
+        /// Insert the vertices between two samples in parallel
+        bool ConcurrentSweep;
+
+        /// Internal numbering of lattice vertices
+        percolation::VertexOrder VertexOrder;
+
+        /// Progress reporting and cancellation, only when running on a worker
+        SweepProgress* Progress;
+
+        /// Precomputed neighborhood of grids that are not lattices, null otherwise
+        std::shared_ptr<const percolation::CSRAdjacency> Adjacency;
+    };
+
+    /// Cluster output of one sweep, published on the main thread.
+    struct ClusterResult {
+        std::shared_ptr<DataSet> Clusters;
+        std::shared_ptr<DataFrame> Statistics;
+        float ThresholdValue = 0;
+        bool HasLocalGlobalStats = false;
+        float GlobalClusterPercentage = 0;
+        float GlobalVoxelPercentage = 0;
+    };
+
     // Construction / Deconstruction
 public:
     PercolationAnalysis();
-    virtual ~PercolationAnalysis() = default;
+    virtual ~PercolationAnalysis();
 
     // Methods
 public:
@@ -78,14 +322,191 @@ protected:
     /// Our main computation function
     virtual void process() override;
 
+    /// Selects the smallest index type that can address all vertices, then runs the sweep.
+    /// Appends one row per sample to Stats. Does not touch any property or port.
     template <typename T>
     void processChannel(const DataChannel<T, 1>& data, const DataChannel<double, 1>& volume,
-                        const Connectivity& grid);
+                        const Connectivity& grid, const SweepSettings& Settings,
+                        TStatCache& Stats, ClusterResult& Clusters) const;
+
+    /// Orders all vertices, in memory or out-of-core, with all vertex ids stored as TIndex.
+    template <typename T, typename TIndex>
+    void processChannelIndexed(const DataChannel<T, 1>& data,
+                               const DataChannel<double, 1>& volume, const Connectivity& grid,
+                               const SweepSettings& Settings, TStatCache& Stats,
+                               ClusterResult& Clusters) const;
+
+    /// Index and value range of the sweep, and how samples are placed in it.
+    struct SampleWindow {
+        ind MinIdx;
+        ind MaxIdx;
+        ind NumSamples;
+        ind BinSize;
+        double HStep;
+        float MinVal;
+        float MaxVal;
+    };
+
+    /// Where a sweep starts and samples. Used by the two passes of the adaptive sampling.
+    struct SweepPass {
+        /// Overrides the sample window derived from the settings
+        const SampleWindow* Window = nullptr;
+        /// Sorted index to start at. All vertices before are already in the union-find.
+        ind FirstIdx = 0;
+        /// Called after each recorded sample, with the next sorted index,
+        /// largest / total volume and whether the field percolates.
+        std::function<void(ind, double, bool)> OnSample;
+    };
+
+    /// Finds the sorted index range within the window, and the sample spacing.
+    template <typename T, typename TIndex>
+    SampleWindow computeSampleWindow(const std::pair<T, TIndex>* values, const ind NumSorted,
+                                     const SweepSettings& Settings) const;
+
+    /// Number of samples to record after sweeping the i-th sorted vertex.
+    /// Their h values are written to xValuesStat. nextVal tracks value-based sampling.
+    template <bool ValueSampling>
+    ind collectSamples(const ind i, const double xValue, const SampleWindow& Window,
+                       double& nextVal, std::vector<double>& xValuesStat) const;
+
+    /// Appends one row to the statistics.
+    void appendSample(TStatCache& Stats, const SweepSettings& Settings,
+                      const SampleWindow& Window, const double h, const ind numComps,
+                      const double TotalVolume, const double LargestVolume,
+                      const bool percolating) const;
+
+    /// Sweeps over the vertices in decreasing order, recording statistics.
+    /// Picks the kernel for the grid type and sampling mode.
+    /// NumSorted values are given, masked vertices are not among them.
+    /// The union-find and the component state are indexed by Ordering(vertex id).
+    template <typename T, typename TIndex, typename TVolumes, typename TUnionFind,
+              typename TOrdering = percolation::IdentityOrder>
+    void sweepSortedValues(const std::pair<T, TIndex>* values, const ind NumSorted,
+                           const ind NumVertices,
+                           const TVolumes& Volumes, TUnionFind& UF, const Connectivity& grid,
+                           const GridPrimitive GridElemDim, const SweepSettings& Settings,
+                           TStatCache& Stats, ClusterResult& Clusters,
+                           const TOrdering& Ordering = TOrdering(),
+                           const SweepPass& Pass = SweepPass()) const;
+
+    /// Adaptive sampling in two passes. A coarse pass keeps union-find checkpoints and finds
+    /// the steepest rise of largest / total volume and the percolation onset.
+    /// A dense pass resumes at the checkpoint before that region and samples it finely.
+    /// The rows of both passes are merged in sweep order.
+    /// Falls back to a single voxel-based pass if four union-finds do not fit into memory.
+    template <typename T, typename TIndex, typename TVolumes, typename TUnionFind,
+              typename TOrdering = percolation::IdentityOrder>
+    void sweepAdaptive(const std::pair<T, TIndex>* values, const ind NumSorted,
+                       const ind NumVertices, const TVolumes& Volumes, TUnionFind& UF,
+                       const Connectivity& grid, const GridPrimitive GridElemDim,
+                       const SweepSettings& Settings, TStatCache& Stats, ClusterResult& Clusters,
+                       const TOrdering& Ordering = TOrdering()) const;
+
+    /// The actual sweep. Lattice handling and sampling mode are compile-time constants,
+    /// so the per-vertex loop carries no checks for them.
+    template <bool IsLattice, bool ValueSampling, typename T, typename TIndex, typename TVolumes,
+              typename TUnionFind, typename TOrdering>
+    void sweepKernel(const std::pair<T, TIndex>* values, const ind NumSorted,
+                     const ind NumVertices,
+                     const TVolumes& Volumes, TUnionFind& UF, const Connectivity& grid,
+                     const GridPrimitive GridElemDim, const SweepSettings& Settings,
+                     TStatCache& Stats, ClusterResult& Clusters,
+                     const TOrdering& Ordering, const SweepPass& Pass) const;
+
+    /// Same statistics as sweepSortedValues, but all vertices between two samples are
+    /// inserted and unioned concurrently. Works on any connectivity.
+    template <typename T, typename TIndex, typename TVolumes>
+    void sweepConcurrent(const std::pair<T, TIndex>* values, const ind NumSorted,
+                         const ind NumVertices,
+                         const TVolumes& Volumes, const Connectivity& grid,
+                         const GridPrimitive GridElemDim, const SweepSettings& Settings,
+                         TStatCache& Stats, ClusterResult& Clusters) const;
+
     struct Extent;
-    void createClusterOutput(const UnionFind* clusters, const ind maxClusterId,
-                             const std::map<ind, Extent>& extends,
-                             const std::map<ind, double>& volumes,
-                             const std::array<ind, 3>& totalSize);
+    template <typename TUnionFind, typename TIndex = typename TUnionFind::IndexType>
+    void createClusterOutput(const TUnionFind* clusters, const TIndex maxClusterId,
+                             const std::map<TIndex, Extent>& extends,
+                             const std::map<TIndex, double>& volumes,
+                             const std::array<ind, 3>& totalSize, const SweepSettings& Settings,
+                             ClusterResult& Clusters) const;
+
+    /// Downsamples the lattice by 2^Settings.ResolutionLevel and sweeps that. No cluster output.
+    template <typename T>
+    void sweepDownsampled(const DataChannel<T, 1>& data, const DataChannel<double, 1>& volume,
+                          const StructuredGrid<3>& lattice, const percolation::Pooling pooling,
+                          const SweepSettings& Settings, TStatCache& Stats) const;
+
+    /// Reads all property values the sweep needs.
+    SweepSettings gatherSweepSettings() const;
+
+    /// Runs the sweep on the given scalar and volume channel.
+    void runSweep(const Channel& scalar, const DataChannel<double, 1>& volume,
+                  const Connectivity& grid, const SweepSettings& Settings, TStatCache& Stats,
+                  ClusterResult& Clusters) const;
+
+    /// Sweeps several scalars concurrently, sharing the volume, grid, adjacency and mask.
+    /// Rows are appended channel by channel. Only the first channel gives cluster output
+    /// and reports progress, the others follow its cancellation.
+    /// A level above 0 sweeps downsampled copies of the lattice.
+    void runSweeps(const std::vector<std::shared_ptr<const Channel>>& scalars,
+                   const DataChannel<double, 1>& volume, const Connectivity& grid,
+                   const SweepSettings& Settings, const percolation::Pooling pooling,
+                   TStatCache& Stats, ClusterResult& Clusters) const;
+
+    /// The selected scalar first, then the further scalars found in the dataset.
+    std::vector<std::shared_ptr<const Channel>> getScalarChannels(
+        const DataSet& dataSet, std::shared_ptr<const Channel> primary) const;
+
+    /// Keeps the rows of a finished level, or adds them to the aggregate when aggregating.
+    void recordRows(const TStatCache& Rows);
+
+    /// Whether iterations are aggregated instead of kept row by row
+    bool isAggregating() const { return propAggregateRuns.get() && RunID >= 0; }
+
+    /// Per-row table of the given statistics, or the aggregate of all iterations.
+    std::shared_ptr<DataFrame> createOutputTable(const TStatCache& Stats) const;
+
+    /// Mean, spread, range and 95% confidence band per sample index over all iterations.
+    std::shared_ptr<DataFrame> createAggregateTable() const;
+
+    /// Rows of the output table, about propMaxTableRows. Evenly spaced, but every change of
+    /// run, scalar, resolution or percolation is kept, so the steps stay sharp.
+    std::vector<ind> selectTableRows(const TStatCache& Stats) const;
+
+    /// Builds the output table. The maximal number of components is taken from the current run,
+    /// per scalar channel.
+    std::shared_ptr<DataFrame> createStatisticsTable(const TStatCache& Stats,
+                                                     const ind FirstRowOfRun) const;
+
+    /// Sets cluster ports and the read-only result properties.
+    void publishClusterResult(const ClusterResult& Clusters);
+
+    /// Runs the sweep on the thread pool. For progressive runs, the coarsest level is computed
+    /// right away, the finer ones in the background.
+    void startEvaluation(std::vector<std::shared_ptr<const Channel>> scalars,
+                         std::shared_ptr<const DataChannel<double, 1>> volume,
+                         std::shared_ptr<const Connectivity> grid, SweepSettings Settings,
+                         const bool progressive);
+
+    /// Cached CSR adjacency of the given grid. Null for lattices, they have a fast neighborhood.
+    std::shared_ptr<const percolation::CSRAdjacency> getAdjacency(
+        const std::shared_ptr<const Connectivity>& grid, const GridPrimitive elemDim) const;
+
+    /// Cancels the running evaluation and waits for it to return.
+    void stopEvaluation();
+
+    /// Publishes finished levels and partial curves of a background evaluation.
+    /// Returns false if there was nothing to publish.
+    bool publishPendingResults();
+
+    /// Shows the progress of the running evaluation.
+    void updateProgressProperties(const SweepProgress& Progress, const bool finished);
+
+    /// Whether any user-editable property or the inport changed since the last evaluation.
+    bool hasModifiedInput() const;
+
+    /// Appends the time of a full resolution sweep to Performance.csv in the statistics folder.
+    void recordPerformance(const Connectivity& grid, const float seconds) const;
 
     void updateProperties();
     template <typename T>
@@ -110,9 +531,20 @@ public:
     /// Scalar Field Channel worked upon
     DataChannelProperty propScalarChannel;
 
+    /// Names of further scalar vertex channels, analysed in the same run.
+    /// Comma-separated, surrounding blanks are ignored. Names not found in the input are skipped
+    /// with a warning. Free text, since the set of channels is only known once data arrives.
+    StringProperty propFurtherScalars;
+
     /// Volume channel used to compute percolation function
     DataChannelProperty propVolumeChannel;
 
+    /// Which vertices to exclude from the sweep
+    TemplateOptionProperty<percolation::MaskSource> propMaskSource;
+
+    /// Mask channel, zero excludes a vertex
+    DataChannelProperty propMaskChannel;
+
     /// How to choose min and max H
     CompositeProperty propMinMaxSettings;
     /// Take away some part of voxels from both ends
@@ -128,22 +560,83 @@ public:
     /// How to choose min and max H
     CompositeProperty propSampleSettings;
 
-    /// Value-based or Voxel-based
+    /// Value-based, Voxel-based or Adaptive.
+    /// Adaptive keeps up to three union-find copies as checkpoints, i.e., four times the
+    /// union-find memory, and copies the union-find at every coarse sample.
+    /// It samples by voxels if that does not fit into the available memory.
     OptionPropertyInt propSampleType;
     /// How often to sample the statistics
     IntProperty propNumSamples;
+    /// Rows in the output table at most, 0 for all
+    IntProperty propMaxTableRows;
+    /// One voxel-based sample per run of equal values
+    BoolProperty propBatchPlateaus;
     /// Percolation dimension
     TemplateOptionProperty<PercolationDimension> propPercDim;
 
     /// To start an iteration over a parameter.
     ButtonProperty propIterationBtn;
 
+    /// Only keep mean, variance and range of all iterations, per sample index
+    BoolProperty propAggregateRuns;
+
     /// Everything related to analysing the performace / output of the algorithm
     CompositeProperty propAlgorithmAnalysis;
 
     /// Folder to write performance data to
     FileProperty propPerformanceStatsFolderName;
 
+    /// Settings for fields larger than memory
+    CompositeProperty propOutOfCoreSettings;
+
+    /// Sort externally and keep the union-find in a mapped file
+    BoolProperty propOutOfCore;
+
+    /// Folder for temporary sort runs and mapped files
+    FileProperty propScratchFolder;
+
+    /// Memory used for in-memory sort runs, in MB
+    IntProperty propOutOfCoreMemory;
+
+    /// Settings for quick previews on downsampled data
+    CompositeProperty propProgressiveSettings;
+
+    /// Analyse downsampled versions first, refine in the background
+    BoolProperty propProgressive;
+
+    /// Coarsest level to start with, as power of 2 of the downsampling factor
+    TemplateOptionProperty<int> propPreviewLevel;
+
+    /// How to combine the scalars of a block
+    TemplateOptionProperty<percolation::Pooling> propPooling;
+
+    /// Background evaluation and its progress
+    CompositeProperty propEvaluationSettings;
+
+    /// Run the sweep on a worker thread instead of the network evaluation thread
+    BoolProperty propBackgroundEvaluation;
+
+    /// Publish the curve recorded so far while the sweep is running
+    BoolProperty propPublishPartial;
+
+    /// Seconds between two partial curves
+    FloatProperty propPartialInterval;
+
+    /// Parallel sweep with a concurrent union-find
+    BoolProperty propConcurrentSweep;
+
+    /// Internal numbering of lattice vertices in the sweep
+    TemplateOptionProperty<percolation::VertexOrder> propVertexOrder;
+
+    /// Fraction of vertices swept in the current level
+    FloatProperty propProgress;
+
+    /// Number of samples recorded in the current level
+    IntProperty propSamplesEmitted;
+
+    /// Estimated remaining seconds of the current level
+    FloatProperty propETA;
+
     /// All property regaring cluster output
     CompositeProperty propClusterOutput;
 
@@ -179,6 +672,46 @@ private:
     /// Run ID when iterating
     ind RunID;
 
+    /// Aggregated quantities: H, value fraction, normalized volume, number of components,
+    /// largest / total volume and percolation.
+    static constexpr size_t NumAggregated = 6;
+
+    /// Statistics of all iterations, when aggregating
+    percolation::EnsembleStatistics<NumAggregated> Aggregate;
+
+    /// Statistics and clusters of levels finished in the background, not yet published.
+    struct PendingResult {
+        TStatCache Stats;
+        ClusterResult Clusters;
+        size_t Generation;
+        int ResolutionLevel;
+        /// Time the level took, recorded with the performance of full resolution sweeps
+        float Seconds;
+    };
+    std::vector<PendingResult> PendingResults;
+    std::mutex PendingMutex;
+
+    /// Incremented for every new run. Results of older runs are discarded.
+    std::atomic<size_t> EvaluationGeneration;
+
+    /// Background evaluation of the current run
+    std::future<void> EvaluationJob;
+
+    /// Progress of the current background evaluation
+    std::shared_ptr<SweepProgress> CurrentProgress;
+
+    /// First row of the current run in the StatCache
+    ind FirstRowOfRun;
+
+    /// Time slice of the previous input, -1 if it had none
+    int LastTimeSlice;
+
+    /// Expires with the processor, guards callbacks dispatched to the main thread.
+    std::shared_ptr<int> Lifetime;
+
+    /// Neighborhoods of unstructured grids, reused across runs
+    mutable percolation::AdjacencyCache Adjacencies;
+
 protected:
     // Save statistics here
     using vec3i = glm::vec<3, ind>;
@@ -228,41 +761,259 @@ protected:
 template <typename T>
 void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
                                          const DataChannel<double, 1>& volume,
-                                         const Connectivity& grid) {
+                                         const Connectivity& grid, const SweepSettings& Settings,
+                                         TStatCache& Stats, ClusterResult& Clusters) const {
+    // 32 bit indices halve the size of the sort pairs (for small T), the union-find and the maps.
+    if (static_cast<std::uint64_t>(data.size()) <
+        percolation::IndexedUnionFind<std::uint32_t>::MaxNumElements)
+        processChannelIndexed<T, std::uint32_t>(data, volume, grid, Settings, Stats, Clusters);
+    else
+        processChannelIndexed<T, ind>(data, volume, grid, Settings, Stats, Clusters);
+}
+
+template <typename T, typename TIndex>
+void PercolationAnalysis::processChannelIndexed(const DataChannel<T, 1>& data,
+                                                const DataChannel<double, 1>& volume,
+                                                const Connectivity& grid,
+                                                const SweepSettings& Settings, TStatCache& Stats,
+                                                ClusterResult& Clusters) const {
     ivwAssert(data.getGridPrimitiveType() == volume.getGridPrimitiveType(),
               "Data and volume must be given on same grid element.");
 
-    ind NumVertices = data.size();
+    using ValuePair = std::pair<T, TIndex>;
+    const ind NumVertices = data.size();
+    const GridPrimitive GridElemDim = data.getGridPrimitiveType();
 
-    // Sort by value
-    std::vector<std::pair<T, ind>> values(NumVertices, std::make_pair((T)0, -1));
-    for (ind dIdx = 0; dIdx < NumVertices; ++dIdx) {
-        values[dIdx].second = dIdx;
-        data.fill(values[dIdx].first, dIdx);
-    }
-    std::sort(values.begin(), values.end(), [](const auto& a, const auto& b) {
+    // Decreasing by value. Ties are broken by index, making the order total.
+    auto Compare = [](const ValuePair& a, const ValuePair& b) {
         return (a.first == b.first) ? (a.second > b.second) : (a.first > b.first);
-    });
+    };
 
+    // Contiguous access to all values. No copy for buffer channels.
+    const percolation::ContiguousChannelData<T> DataValues(data);
+
+    // Masked vertices are never sorted, and never become part of a component.
+    const percolation::VertexMask* Mask =
+        (Settings.MaskSource == percolation::MaskSource::Channel && Settings.Mask &&
+         static_cast<ind>(Settings.Mask->size()) == NumVertices)
+            ? Settings.Mask.get()
+            : nullptr;
+    const bool MaskNonFinite = Settings.MaskSource == percolation::MaskSource::NonFinite;
+
+    // Adaptive sampling needs union-find checkpoints. The other sweeps sample uniformly by voxel.
+    const bool Adaptive = Settings.SampleType == 2 && !Settings.OutOfCore && !Settings.ConcurrentSweep;
+    if (Settings.SampleType == 2 && !Adaptive)
+        LogInfo("Adaptive sampling needs the in-memory serial sweep. Sampling by voxels.");
+    const bool HasMask = Mask || MaskNonFinite;
+    auto IsActive = [&](const ind dIdx) {
+        if (Mask) return (*Mask)[dIdx] != 0;
+        if (MaskNonFinite) return percolation::isRegularValue(DataValues[dIdx]);
+        return true;
+    };
+
+    if (!Settings.OutOfCore) {
+        const percolation::ContiguousChannelData<double> Volumes(volume);
+
+        // Sort by value. A precomputed order, e.g., from a cache file, replaces the sort.
+        // Integers with a small range are counted instead.
+        std::vector<ValuePair> values;
+        bool Sorted = false;
+        if (Settings.ResolutionLevel == 0 && Settings.InDataSet) {
+            auto Order = Settings.InDataSet->getChannel(
+                percolation::sortedOrderName(Settings.ChannelName), GridElemDim);
+            if (Order) {
+                Sorted = percolation::gatherInOrder(*Order, DataValues, NumVertices, IsActive,
+                                                    values);
+                if (!Sorted) LogWarn("The stored order does not sort the scalar. Sorting anew.");
+            }
+        }
+        if (!Sorted && std::is_integral<T>::value && NumVertices > 0) {
+            const auto MinMax =
+                std::minmax_element(DataValues.data(), DataValues.data() + NumVertices);
+            if (percolation::useCountingSort(*MinMax.first, *MinMax.second, NumVertices)) {
+                percolation::countingSortDescending(DataValues, NumVertices, *MinMax.first,
+                                                    *MinMax.second, values, IsActive);
+                Sorted = true;
+            }
+        }
+
+        if (!Sorted) {
+            if (HasMask) {
+                percolation::gatherActiveValues(DataValues, NumVertices, IsActive, values);
+            } else {
+                values.assign(NumVertices, std::make_pair((T)0, TIndex(0)));
+#pragma omp parallel for
+                for (ind dIdx = 0; dIdx < NumVertices; ++dIdx) {
+                    values[dIdx] = std::make_pair(DataValues[dIdx], static_cast<TIndex>(dIdx));
+                }
+            }
+            // In the background, the sort can be cancelled.
+            if (Settings.Progress) {
+                const SweepProgress* Progress = Settings.Progress;
+                if (!percolation::sortCancellable(values.begin(), values.end(), Compare,
+                                                  [Progress]() { return Progress->IsCancelled(); }))
+                    return;
+            } else {
+                std::sort(values.begin(), values.end(), Compare);
+            }
+        }
+        const ind NumSorted = static_cast<ind>(values.size());
+        if (HasMask) {
+            LogInfo("\t" << NumVertices - NumSorted << " of " << NumVertices
+                         << " vertices are masked.");
+        }
+
+        if (Settings.ConcurrentSweep) {
+            sweepConcurrent(values.data(), NumSorted, NumVertices, Volumes, grid, GridElemDim,
+                            Settings, Stats, Clusters);
+            return;
+        }
+
+        // Renumber lattice vertices for locality, if the padded ids still fit the index type.
+        const auto* lattice = dynamic_cast<const StructuredGrid<3>*>(&grid);
+        if (lattice && Settings.VertexOrder != percolation::VertexOrder::Linear) {
+            const percolation::LatticeOrder Ordering(lattice->getNumVertices(),
+                                                     Settings.VertexOrder);
+            const ind NumOrdered = Ordering.GetNumOrdered(NumVertices);
+            if (static_cast<std::uint64_t>(NumOrdered) <
+                percolation::IndexedUnionFind<TIndex>::MaxNumElements) {
+                percolation::IndexedUnionFind<TIndex> UF(NumOrdered);
+                if (Adaptive)
+                    sweepAdaptive(values.data(), NumSorted, NumVertices, Volumes, UF, grid,
+                                  GridElemDim, Settings, Stats, Clusters, Ordering);
+                else
+                    sweepSortedValues(values.data(), NumSorted, NumVertices, Volumes, UF, grid,
+                                      GridElemDim, Settings, Stats, Clusters, Ordering);
+                return;
+            }
+        }
+
+        percolation::IndexedUnionFind<TIndex> UF(NumVertices);
+        if (Adaptive)
+            sweepAdaptive(values.data(), NumSorted, NumVertices, Volumes, UF, grid, GridElemDim,
+                          Settings, Stats, Clusters);
+        else
+            sweepSortedValues(values.data(), NumSorted, NumVertices, Volumes, UF, grid,
+                              GridElemDim, Settings, Stats, Clusters);
+        return;
+    }
+
+    // Out-of-core: Sort in bounded-memory runs, merge into one file and map that.
+    const std::string& ScratchFolder = Settings.ScratchFolder;
+    if (!filesystem::directoryExists(ScratchFolder)) {
+        LogWarn("Scratch folder for out-of-core sorting does not exist.");
+        return;
+    }
+    const std::string ScratchPrefix =
+        ScratchFolder + "/percolation_" + std::to_string(reinterpret_cast<std::uintptr_t>(&Stats));
+
+    PerformanceTimer Timer;
+    {
+        const size_t MaxRecords =
+            Settings.OutOfCoreMemory * 1024 * 1024 / sizeof(ValuePair);
+        percolation::ExternalSorter<ValuePair, decltype(Compare)> Sorter(ScratchFolder, MaxRecords,
+                                                                          Compare);
+        for (ind dIdx = 0; dIdx < NumVertices; ++dIdx) {
+            if (Settings.Progress && (dIdx & 0xFFFF) == 0 && Settings.Progress->IsCancelled())
+                return;
+            if (HasMask && !IsActive(dIdx)) continue;
+            Sorter.Add(std::make_pair(DataValues[dIdx], static_cast<TIndex>(dIdx)));
+        }
+        if (!Sorter.Finish(ScratchPrefix + "_sorted.bin")) {
+            LogWarn("External sorting failed.");
+            return;
+        }
+        LogInfo("\tExternal sort of " << Sorter.GetNumRecords() << " values in "
+                                      << Sorter.GetNumRuns()
+                                      << " runs took " << Timer.ElapsedTimeAndReset()
+                                      << " seconds.");
+    }
+
+    percolation::MappedArray<ValuePair> SortedValues;
+    if (!SortedValues.Open(ScratchPrefix + "_sorted.bin", false, true) ||
+        static_cast<ind>(SortedValues.size()) > NumVertices) {
+        LogWarn("Could not map sorted values.");
+        return;
+    }
+    const ind NumSorted = static_cast<ind>(SortedValues.size());
+
+    // Union-find parents in a mapped file. Lattices index it by 8^3 bricks, see LatticeOrder:
+    // Neighbors mostly share a page, and the ordered ids are taken from the vertex positions
+    // the sweep has anyway, so accessing a parent needs no splitting of linear ids.
+    const auto* lattice = dynamic_cast<const StructuredGrid<3>*>(&grid);
+    std::unique_ptr<percolation::LatticeOrder> Ordering;
+    if (lattice) {
+        Ordering = std::make_unique<percolation::LatticeOrder>(lattice->getNumVertices(),
+                                                               percolation::VertexOrder::Bricked);
+        if (static_cast<std::uint64_t>(Ordering->GetNumOrdered(NumVertices)) >=
+            percolation::IndexedUnionFind<TIndex>::MaxNumElements)
+            Ordering.reset();
+    }
+    percolation::MappedArray<TIndex> ParentStorage;
+    if (!ParentStorage.Create(ScratchPrefix + "_parents.bin",
+                              Ordering ? Ordering->GetNumOrdered(NumVertices) : NumVertices)) {
+        LogWarn("Could not create union-find scratch file.");
+        return;
+    }
+    percolation::IndexedUnionFind<TIndex, percolation::MappedArray<TIndex>> UF(
+        std::move(ParentStorage));
+
+    auto sweep = [&](const auto& Volumes) {
+        if (Ordering)
+            sweepSortedValues(SortedValues.data(), NumSorted, NumVertices, Volumes, UF, grid,
+                              GridElemDim, Settings, Stats, Clusters, *Ordering);
+        else
+            sweepSortedValues(SortedValues.data(), NumSorted, NumVertices, Volumes, UF, grid,
+                              GridElemDim, Settings, Stats, Clusters);
+    };
+
+    // Do not materialize analytic volumes, that would be another 8 bytes per vertex.
+    if (dynamic_cast<const BufferChannel<double, 1>*>(&volume))
+        sweep(percolation::ContiguousChannelData<double>(volume));
+    else
+        sweep(percolation::ChannelElementAccess<double>(volume));
+}
+
+template <typename T, typename TIndex>
+PercolationAnalysis::SampleWindow PercolationAnalysis::computeSampleWindow(
+    const std::pair<T, TIndex>* values, const ind NumSorted,
+    const SweepSettings& Settings) const {
     // Excude -inf values (These are created for exlusion of borders in the Duct dataset case).
-    auto endBound = std::lower_bound(values.begin(), values.end(),
-                                     static_cast<T>(-std::numeric_limits<double>::max()),
-                                     [](auto a, auto b) { return a.first > b; });
+    // The sentinel is the lowest value of T, -max for double and float alike.
+    // Integer scalars have no sentinel, see isRegularValue. Their lowest value, e.g., 0, is data.
+    const std::pair<T, TIndex>* endBound = values + NumSorted;
+    if (std::is_floating_point<T>::value)
+        endBound = std::lower_bound(values, values + NumSorted, std::numeric_limits<T>::lowest(),
+                                    [](auto a, auto b) { return a.first > b; });
     // Should we increase the endBound by one?
-    ind NumElements = endBound - values.begin();
+    ind NumElements = endBound - values;
+
+    // Nothing to sample, e.g., all vertices are masked: No rows.
+    SampleWindow Empty;
+    Empty.MinIdx = 0;
+    Empty.MaxIdx = -1;
+    Empty.NumSamples = 0;
+    Empty.BinSize = 1;
+    Empty.HStep = -1;
+    Empty.MinVal = 0;
+    Empty.MaxVal = 0;
+    if (NumElements == 0) {
+        LogInfo("No values to sample.");
+        return Empty;
+    }
 
     ind minIdx = 0;
     ind maxIdx = NumElements - 1;
-    ind numSamples = propNumSamples.get();
+    ind numSamples = Settings.NumSamples;
     float minVal, maxVal;
 
     // Take percentage of data away.
-    if (propUsePercentage.get()) {
-        minIdx = std::floor((float)NumElements * propPercentage.get() * 0.01f);
+    if (Settings.UsePercentage) {
+        minIdx = std::floor((float)NumElements * Settings.Percentage * 0.01f);
         minIdx = std::max(ind(0), minIdx);
 
-        if (propCutOffBothEnds.get()) {
-            maxIdx = std::ceil((float)NumElements * (100.0f - propPercentage.get()) * 0.01f);
+        if (Settings.CutOffBothEnds) {
+            maxIdx = std::ceil((float)NumElements * (100.0f - Settings.Percentage) * 0.01f);
             maxIdx = std::min(NumElements - 1, maxIdx);
         }
 
@@ -281,18 +1032,18 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
     } else {
         // Look for min and max value.
         // For upper bound (compare (value element)), for lower bound (compare(element, value))
-        minIdx = std::upper_bound(values.begin(), endBound, propWindowH.getEnd(),
+        minIdx = std::upper_bound(values, endBound, Settings.WindowEnd,
                                   [](auto a, auto b) { return a > b.first; }) -
-                 values.begin();
-        maxIdx = std::lower_bound(values.begin(), endBound, propWindowH.getStart(),
+                 values;
+        maxIdx = std::lower_bound(values, endBound, Settings.WindowStart,
                                   [](auto a, auto b) { return a.first > b; }) -
-                 values.begin();
+                 values;
 
         minIdx = std::max(ind(0), minIdx);
         maxIdx = std::min(NumElements - 1, maxIdx);
 
-        minVal = propWindowH.getStart();
-        maxVal = propWindowH.getEnd();
+        minVal = Settings.WindowStart;
+        maxVal = Settings.WindowEnd;
 
         LogInfo("Data within range = [" << values[maxIdx].first << "(" << maxIdx << "), "
                                         << values[minIdx].first << "(" << minIdx << ")]");
@@ -300,80 +1051,361 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
 
     // Update after filtering
     NumElements = maxIdx - minIdx + 1;
+    if (NumElements <= 0) {
+        LogInfo("No values within the sample window.");
+        return Empty;
+    }
 
     // Step size in case of non-uniform sampling.
     double hStep = -1;  // Actual H value in the data
-    ind binSize = std::max(((NumElements - 1) / (numSamples - 1)), ind(1));
+    const ind numIntervals = std::max(numSamples - 1, ind(1));
+    ind binSize = std::max(((NumElements - 1) / numIntervals), ind(1));
     // Value-based sampling
-    if (propSampleType.get() == 0) {
-        hStep = double(maxVal - minVal) / (numSamples - 1);
+    if (Settings.SampleType == 0) {
+        hStep = double(maxVal - minVal) / numIntervals;
         // Voxel-based sampling
     } else {
         numSamples = (NumElements - 1) / binSize + 1;
     }
 
+    SampleWindow Window;
+    Window.MinIdx = minIdx;
+    Window.MaxIdx = maxIdx;
+    Window.NumSamples = numSamples;
+    Window.BinSize = binSize;
+    Window.HStep = hStep;
+    Window.MinVal = minVal;
+    Window.MaxVal = maxVal;
+    return Window;
+}
+
+template <typename T, typename TIndex, typename TVolumes, typename TUnionFind, typename TOrdering>
+void PercolationAnalysis::sweepSortedValues(const std::pair<T, TIndex>* values,
+                                            const ind NumSorted, const ind NumVertices,
+                                            const TVolumes& Volumes,
+                                            TUnionFind& UF, const Connectivity& grid,
+                                            const GridPrimitive GridElemDim,
+                                            const SweepSettings& Settings, TStatCache& Stats,
+                                            ClusterResult& Clusters,
+                                            const TOrdering& Ordering,
+                                            const SweepPass& Pass) const {
+    const bool IsLattice = dynamic_cast<const StructuredGrid<3>*>(&grid) != nullptr;
+    const bool ValueSampling = Settings.SampleType == 0;
+
+    if (IsLattice) {
+        if (ValueSampling)
+            sweepKernel<true, true>(values, NumSorted, NumVertices, Volumes, UF, grid, GridElemDim, Settings,
+                                    Stats, Clusters, Ordering, Pass);
+        else
+            sweepKernel<true, false>(values, NumSorted, NumVertices, Volumes, UF, grid, GridElemDim,
+                                     Settings, Stats, Clusters, Ordering, Pass);
+    } else {
+        if (ValueSampling)
+            sweepKernel<false, true>(values, NumSorted, NumVertices, Volumes, UF, grid, GridElemDim,
+                                     Settings, Stats, Clusters, Ordering, Pass);
+        else
+            sweepKernel<false, false>(values, NumSorted, NumVertices, Volumes, UF, grid, GridElemDim,
+                                      Settings, Stats, Clusters, Ordering, Pass);
+    }
+}
+
+template <typename T, typename TIndex, typename TVolumes, typename TUnionFind, typename TOrdering>
+void PercolationAnalysis::sweepAdaptive(const std::pair<T, TIndex>* values, const ind NumSorted,
+                                        const ind NumVertices, const TVolumes& Volumes,
+                                        TUnionFind& UF, const Connectivity& grid,
+                                        const GridPrimitive GridElemDim,
+                                        const SweepSettings& Settings, TStatCache& Stats,
+                                        ClusterResult& Clusters, const TOrdering& Ordering) const {
+    // The working union-find and up to three checkpoints. Unknown available memory is no limit.
+    const std::uint64_t CheckpointBytes =
+        4 * UF.GetNumElements() * sizeof(typename TUnionFind::IndexType);
+    const std::uint64_t AvailableBytes = percolation::GetAvailableMemory();
+    if (AvailableBytes > 0 && CheckpointBytes > AvailableBytes) {
+        LogWarn("Adaptive sampling needs " << (CheckpointBytes >> 20)
+                                           << " MB for union-find checkpoints, but only "
+                                           << (AvailableBytes >> 20)
+                                           << " MB are available. Sampling by voxels.");
+        sweepSortedValues(values, NumSorted, NumVertices, Volumes, UF, grid, GridElemDim,
+                          Settings, Stats, Clusters, Ordering);
+        return;
+    }
+
+    // Coarse pass: A quarter of the samples, evenly spread over the vertices.
+    SweepSettings CoarseSettings = Settings;
+    CoarseSettings.NumSamples = std::max(ind(8), Settings.NumSamples / 4);
+    const SampleWindow Window = computeSampleWindow(values, NumSorted, CoarseSettings);
+
+    // Union-find before a sample interval, and the rows recorded up to there.
+    struct Checkpoint {
+        ind Index = 0;
+        size_t NumRows = 0;
+        std::unique_ptr<TUnionFind> UF;
+    };
+    // Three copies at most: At the last sample, and at the starts of the steepest interval
+    // and of the percolation onset.
+    Checkpoint Last, Steepest, Onset;
+    ind SteepestEnd = -1, OnsetEnd = -1;
+    size_t SteepestEndRows = 0, OnsetEndRows = 0;
+    double LastRatio = 0, MaxIncrease = 0;
+    bool HasLast = false, WasPercolating = false;
+
+    TStatCache Coarse;
+    SweepPass CoarsePass;
+    CoarsePass.Window = &Window;
+    CoarsePass.OnSample = [&](const ind nextIdx, const double ratio, const bool percolating) {
+        // The ratio starts at 1 with the first component, so the first sample only checkpoints.
+        if (HasLast) {
+            if (ratio - LastRatio > MaxIncrease) {
+                MaxIncrease = ratio - LastRatio;
+                std::swap(Steepest, Last);
+                SteepestEnd = nextIdx;
+                SteepestEndRows = Coarse.size();
+            }
+            if (percolating && !WasPercolating) {
+                // Often the same interval as the steepest one, which may still move on.
+                if (SteepestEnd == nextIdx) {
+                    Onset.Index = Steepest.Index;
+                    Onset.NumRows = Steepest.NumRows;
+                    Onset.UF = std::make_unique<TUnionFind>(*Steepest.UF);
+                } else {
+                    std::swap(Onset, Last);
+                }
+                OnsetEnd = nextIdx;
+                OnsetEndRows = Coarse.size();
+            }
+        }
+        if (Last.UF)
+            *Last.UF = UF;
+        else
+            Last.UF = std::make_unique<TUnionFind>(UF);
+        Last.Index = nextIdx;
+        Last.NumRows = Coarse.size();
+        LastRatio = ratio;
+        WasPercolating = percolating;
+        HasLast = true;
+    };
+    sweepSortedValues(values, NumSorted, NumVertices, Volumes, UF, grid, GridElemDim,
+                      CoarseSettings, Coarse, Clusters, Ordering, CoarsePass);
+    if (Settings.Progress && Settings.Progress->IsCancelled()) return;
+
+    if (SteepestEnd < 0 && OnsetEnd < 0) {
+        Stats.append(Coarse);
+        return;
+    }
+
+    // Dense pass from the earlier of both starts to the later of both ends.
+    const bool OnsetFirst =
+        OnsetEnd >= 0 && (SteepestEnd < 0 || Onset.Index < Steepest.Index);
+    Checkpoint& Start = OnsetFirst ? Onset : Steepest;
+    const ind End = std::max(SteepestEnd, OnsetEnd);
+    const size_t EndRows = (End == SteepestEnd) ? SteepestEndRows : OnsetEndRows;
+
+    SampleWindow DenseWindow = Window;
+    DenseWindow.MinIdx = Start.Index;
+    DenseWindow.MaxIdx = End - 1;
+    const ind NumDense = std::max(ind(2), Settings.NumSamples - Window.NumSamples);
+    DenseWindow.BinSize =
+        std::max((DenseWindow.MaxIdx - DenseWindow.MinIdx) / (NumDense - 1), ind(1));
+    DenseWindow.NumSamples = (DenseWindow.MaxIdx - DenseWindow.MinIdx) / DenseWindow.BinSize + 1;
+
+    SweepSettings DenseSettings = Settings;
+    DenseSettings.ClusterStatsOutput = false;
+    SweepPass DensePass;
+    DensePass.Window = &DenseWindow;
+    DensePass.FirstIdx = Start.Index;
+
+    TStatCache Dense;
+    ClusterResult NoClusters;
+    sweepSortedValues(values, NumSorted, NumVertices, Volumes, *Start.UF, grid, GridElemDim,
+                      DenseSettings, Dense, NoClusters, Ordering, DensePass);
+    LogInfo("\tAdaptive sampling: " << Dense.size() << " samples between sorted index "
+                                    << DenseWindow.MinIdx << " and " << DenseWindow.MaxIdx
+                                    << ".");
+
+    // Coarse rows before the window, the dense rows, coarse rows after the window.
+    Stats.appendRows(Coarse, 0, Start.NumRows);
+    Stats.append(Dense);
+    Stats.appendRows(Coarse, EndRows, Coarse.size());
+}
+
+template <bool ValueSampling>
+ind PercolationAnalysis::collectSamples(const ind i, const double xValue,
+                                        const SampleWindow& Window, double& nextVal,
+                                        std::vector<double>& xValuesStat) const {
+    ind numInStatWindow = 0;
+    xValuesStat.clear();
+
+    // Find out if we need to write a sample.
+    if (!ValueSampling) {
+        // Sample equal bins, given bin size.
+        numInStatWindow = ((i - Window.MinIdx) % Window.BinSize == 0) ? 1 : 0;
+        // Value-based sample: We repeat samples when values do not occur
+    } else {
+        while (xValue < nextVal) {
+            numInStatWindow++;
+            xValuesStat.push_back(nextVal);
+            nextVal -= Window.HStep;
+        }
+    }
+
+    // Always include the final index
+    if (i == Window.MaxIdx && !numInStatWindow) {
+        numInStatWindow = std::max(ind(1), numInStatWindow);
+        if (ValueSampling) xValuesStat.push_back(Window.MinVal);
+    }
+
+    // Select an h value.
+    if (numInStatWindow && !ValueSampling) xValuesStat.push_back(xValue);
+
+    return numInStatWindow;
+}
+
+template <bool IsLattice, bool ValueSampling, typename T, typename TIndex, typename TVolumes,
+          typename TUnionFind, typename TOrdering>
+void PercolationAnalysis::sweepKernel(const std::pair<T, TIndex>* values, const ind NumSorted,
+                                      const ind NumVertices, const TVolumes& Volumes, TUnionFind& UF,
+                                      const Connectivity& grid, const GridPrimitive GridElemDim,
+                                      const SweepSettings& Settings, TStatCache& Stats,
+                                      ClusterResult& Clusters, const TOrdering& Ordering,
+                                      const SweepPass& Pass) const {
+    using UnionFindType = TUnionFind;
+
+    const SampleWindow Window =
+        Pass.Window ? *Pass.Window : computeSampleWindow(values, NumSorted, Settings);
+    const ind minIdx = Window.MinIdx;
+    const ind maxIdx = Window.MaxIdx;
+    const ind numSamples = Window.NumSamples;
+
     // Save statistics here
-    std::map<ind, double> VolumePerComponent;
-    std::map<ind, Extent> ExtentPerComponent;
+    std::map<TIndex, double> VolumePerComponent;
+    std::map<TIndex, Extent> ExtentPerComponent;
     double TotalVolume = 0;
 
     // - memory concerns
-    const ind PreviousStatCacheSize = (ind)StatCache.statH.size();
-    StatCache.largestCompVol.reserve(StatCache.largestCompVol.size() + numSamples);
-    StatCache.totalCompVol.reserve(StatCache.totalCompVol.size() + numSamples);
-    StatCache.normalizedCompVol.reserve(StatCache.normalizedCompVol.size() + numSamples);
-    StatCache.numComps.reserve(StatCache.numComps.size() + numSamples);
-    StatCache.statH.reserve(StatCache.statH.size() + numSamples);
-    StatCache.normalizedH.reserve(StatCache.normalizedH.size() + numSamples);
-    StatCache.RunID.reserve(StatCache.RunID.size() + numSamples);
-    StatCache.isPercolating.reserve(StatCache.isPercolating.size() + numSamples);
+    const ind PreviousStatCacheSize = (ind)Stats.statH.size();
+    Stats.reserve(Stats.size() + numSamples);
 
     double maxVolume = 0;
-    ind maxVolumeIndex = -2;
+    TIndex maxVolumeIndex = UnionFindType::None;
     bool percolating = false;
 
     // Structured grid? Use to find out if percolating.
-    const StructuredGrid<3>* lattice = dynamic_cast<const StructuredGrid<3>*>(&grid);
     std::array<ind, 3> latticeVertSize, idxVec;
-    if (lattice) {
-        latticeVertSize = lattice->getNumVertices();
+    if (IsLattice) {
+        latticeVertSize = static_cast<const StructuredGrid<3>&>(grid).getNumVertices();
     }
 
-    // Dimensionality of the grid elements
-    GridPrimitive GridElemDim = data.getGridPrimitiveType();
-
-    // Setup union-find
-    UnionFind UF(NumVertices);
+    // Hoisted out of the loop. Settings may alias the statistics as far as the compiler knows.
+    const PercolationDimension PercDim = Settings.PercDim;
+    const bool ClusterStatsOutput = Settings.ClusterStatsOutput;
+    const ind SampleIdClusters = Settings.SampleIdClusters;
+    const bool StopEarly = Settings.StopEarly;
+    const bool BatchPlateaus = Settings.BatchPlateaus;
+    SweepProgress* const Progress = Settings.Progress;
+    bool PlateauSamplePending = false;
+
+    // How many vertices ahead to prefetch
+    constexpr ind PrefetchDistance = 16;
+    // Lattice positions of the vertices up to PrefetchDistance ahead, by index modulo the distance.
+    // Each vertex is split into its position once, for the prefetch and for its own sweep step.
+    std::array<std::array<ind, 3>, PrefetchDistance> UpcomingPos;
 
     std::vector<ind> Neighbors;
+    const percolation::CSRAdjacency* Adjacency =
+        (Settings.Adjacency && Settings.Adjacency->GetElementDim() == GridElemDim &&
+         Settings.Adjacency->GetNumElements() == NumVertices)
+            ? Settings.Adjacency.get()
+            : nullptr;
     int numMerges = 0;
     int numCreates = 0;
     int numExtends = 0;
 
+    // Resuming from a checkpoint: The union-find is given, the component state is rebuilt.
+    for (ind i = 0; i < Pass.FirstIdx; ++i) {
+        const TIndex Vertex = values[i].second;
+        const TIndex Root = UF.Find(Ordering(Vertex));
+        const double VertexVolume = Volumes[Vertex];
+        TotalVolume += VertexVolume;
+        const double RootVolume = (VolumePerComponent[Root] += VertexVolume);
+        if (RootVolume > maxVolume) {
+            maxVolume = RootVolume;
+            maxVolumeIndex = Root;
+        }
+        if (IsLattice) {
+            Extent& RootExtent = ExtentPerComponent[Root];
+            RootExtent.extend(StructuredGrid<3>::indexFromLinear(Vertex, latticeVertSize));
+            if (!percolating && RootExtent.isPercolating(latticeVertSize, PercDim))
+                percolating = true;
+        }
+    }
+
     //
     std::vector<double> xValuesStat;
-    double nextVal = maxVal;
+    double nextVal = Window.MaxVal;
+
+    if (IsLattice) {
+        for (ind i = Pass.FirstIdx; i < std::min(Pass.FirstIdx + PrefetchDistance, maxIdx + 1); ++i)
+            UpcomingPos[i % PrefetchDistance] =
+                StructuredGrid<3>::indexFromLinear(values[i].second, latticeVertSize);
+    }
 
     // Run over all grid elements in decreasing order
-    for (ind i(0); i <= maxIdx; i++) {
+    for (ind i(Pass.FirstIdx); i <= maxIdx; i++) {
+        // Report every 64k vertices, and stop when cancelled.
+        if (Progress && (i & 0xFFFF) == 0) {
+            if (Progress->IsCancelled()) return;
+            Progress->Report(i, maxIdx + 1, Stats);
+        }
+
+        // Take the position of this vertex before its slot is reused.
+        if (IsLattice) idxVec = UpcomingPos[i % PrefetchDistance];
+
+        // Fetch the union-find entries of upcoming vertices.
+        if (i + PrefetchDistance <= maxIdx) {
+            const TIndex Upcoming = values[i + PrefetchDistance].second;
+            if (IsLattice) {
+                std::array<ind, 3>& Pos = UpcomingPos[i % PrefetchDistance];
+                Pos = StructuredGrid<3>::indexFromLinear(Upcoming, latticeVertSize);
+                UF.Prefetch(Ordering.AtPosition(Pos, Upcoming));
+            } else {
+                UF.Prefetch(Ordering(Upcoming));
+            }
+            if (Adjacency) {
+                for (const ind* pNeigh = Adjacency->NeighborsBegin(Upcoming);
+                     pNeigh != Adjacency->NeighborsEnd(Upcoming); ++pNeigh)
+                    UF.Prefetch(Ordering(static_cast<TIndex>(*pNeigh)));
+            }
+        }
+
         // Shorthand
-        const std::pair<T, ind>& Current = values[i];
-        double CurrentVolume;
-        volume.fill(CurrentVolume, Current.second);
+        const std::pair<T, TIndex>& Current = values[i];
+        const double CurrentVolume = Volumes[Current.second];
         TotalVolume += CurrentVolume;
 
-        if (lattice) {
-            idxVec = StructuredGrid<3>::indexFromLinear(Current.second, latticeVertSize);
-        }
+        // Id in the union-find and the component state
+        const TIndex CurrentId = IsLattice ? Ordering.AtPosition(idxVec, Current.second)
+                                           : Ordering(Current.second);
 
         // Get the number of components in the neighborhood of this grid element
-        // - get a neighborhood iterator with same dimensionality
-        grid.getConnections(Neighbors, Current.second, GridElemDim, GridElemDim);
+        // - get the neighbors with same dimensionality, from the adjacency if we have one
+        const ind* NeighBegin;
+        const ind* NeighEnd;
+        if (Adjacency) {
+            NeighBegin = Adjacency->NeighborsBegin(Current.second);
+            NeighEnd = Adjacency->NeighborsEnd(Current.second);
+        } else {
+            grid.getConnections(Neighbors, Current.second, GridElemDim, GridElemDim);
+            NeighBegin = Neighbors.data();
+            NeighEnd = Neighbors.data() + Neighbors.size();
+        }
         // - for each neighbor
-        std::set<ind> NeighComps;
-        for (const ind& idNeigh : Neighbors) {
-            const ind idSet = UF.Find(idNeigh);
-            if (idSet >= 0) NeighComps.insert(idSet);
+        std::set<TIndex> NeighComps;
+        for (const ind* pNeigh = NeighBegin; pNeigh != NeighEnd; ++pNeigh) {
+            const TIndex idNeigh =
+                IsLattice ? Ordering.Neighbor(idxVec, Current.second, static_cast<TIndex>(*pNeigh))
+                          : Ordering(static_cast<TIndex>(*pNeigh));
+            const TIndex idSet = UF.Find(idNeigh);
+            if (idSet != UnionFindType::None) NeighComps.insert(idSet);
         }
 
         // Create, extend, or merge components based on the number of components that we have in
@@ -382,24 +1414,24 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
             case 0: {
                 numCreates++;
 
-                UF.MakeSet(Current.second);
-                VolumePerComponent.insert(std::make_pair(Current.second, CurrentVolume));
+                UF.MakeSet(CurrentId);
+                VolumePerComponent.insert(std::make_pair(CurrentId, CurrentVolume));
 
                 // Update maxima.
                 if (CurrentVolume > maxVolume) {
                     maxVolume = CurrentVolume;
-                    maxVolumeIndex = Current.second;
+                    maxVolumeIndex = CurrentId;
                 }
                 maxVolume = std::max(maxVolume, CurrentVolume);
-                if (lattice)
-                    ExtentPerComponent.insert(std::make_pair(Current.second, Extent(idxVec)));
+                if (IsLattice)
+                    ExtentPerComponent.insert(std::make_pair(CurrentId, Extent(idxVec)));
                 break;
             }
 
             case 1: {
                 numExtends++;
-                const ind ExtendID = *(NeighComps.cbegin());
-                UF.ExtendSetByID(ExtendID, Current.second);
+                const TIndex ExtendID = *(NeighComps.cbegin());
+                UF.ExtendSetByID(ExtendID, CurrentId);
                 VolumePerComponent[ExtendID] += CurrentVolume;
 
                 double newVolume = VolumePerComponent[ExtendID];
@@ -410,10 +1442,11 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
                     maxVolumeIndex = ExtendID;
                 }
 
-                if (lattice) {
-                    ExtentPerComponent[ExtendID].extend(idxVec);
-                    if (ExtentPerComponent[ExtendID].isPercolating(latticeVertSize,
-                                                                   propPercDim.getSelectedValue()))
+                if (IsLattice) {
+                    Extent& ExtendExtent = ExtentPerComponent[ExtendID];
+                    ExtendExtent.extend(idxVec);
+                    // Once percolating, always percolating.
+                    if (!percolating && ExtendExtent.isPercolating(latticeVertSize, PercDim))
                         percolating = true;
                 }
                 break;
@@ -423,21 +1456,30 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
                 numMerges++;
 
                 // We have more than 1 component. All of them need to be merged.
-                // In our specific case, it does not matter which component "wins".
-                // - get the first element
+                // For the statistics, it does not matter which component "wins".
+                // - the lowest linear id, so that cluster ids do not depend on the vertex order
                 auto it = NeighComps.cbegin();
-                const ind FirstComp = *it;
+                TIndex FirstComp = *it;
+                TIndex FirstLinear = Ordering.Linear(FirstComp);
                 for (it++; it != NeighComps.cend(); it++) {
-                    UF.Union(*it, FirstComp);
-                    VolumePerComponent[FirstComp] += VolumePerComponent[*it];
+                    const TIndex Linear = Ordering.Linear(*it);
+                    if (Linear < FirstLinear) {
+                        FirstComp = *it;
+                        FirstLinear = Linear;
+                    }
+                }
+                for (const TIndex Comp : NeighComps) {
+                    if (Comp == FirstComp) continue;
+                    UF.Union(Comp, FirstComp);
+                    VolumePerComponent[FirstComp] += VolumePerComponent[Comp];
 
                     // Merge extents.
-                    if (lattice) ExtentPerComponent[FirstComp].merge(ExtentPerComponent[*it]);
+                    if (IsLattice) ExtentPerComponent[FirstComp].merge(ExtentPerComponent[Comp]);
 
-                    VolumePerComponent.erase(*it);
+                    VolumePerComponent.erase(Comp);
                 }
                 // - and the current point itself!
-                UF.ExtendSetByID(FirstComp, Current.second);
+                UF.ExtendSetByID(FirstComp, CurrentId);
                 VolumePerComponent[FirstComp] += CurrentVolume;
 
                 double newVolume = VolumePerComponent[FirstComp];
@@ -449,10 +1491,10 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
                 }
 
                 maxVolume = std::max(maxVolume, VolumePerComponent[FirstComp]);
-                if (lattice) {
-                    ExtentPerComponent[FirstComp].extend(idxVec);
-                    if (ExtentPerComponent[FirstComp].isPercolating(latticeVertSize,
-                                                                    propPercDim.getSelectedValue()))
+                if (IsLattice) {
+                    Extent& FirstExtent = ExtentPerComponent[FirstComp];
+                    FirstExtent.extend(idxVec);
+                    if (!percolating && FirstExtent.isPercolating(latticeVertSize, PercDim))
                         percolating = true;
                 }
                 break;
@@ -461,149 +1503,323 @@ void PercolationAnalysis::processChannel(const DataChannel<T, 1>& data,
 
         if (i < minIdx) continue;
 
-        ind numInStatWindow = 0;
-        double xValue = values[i].first;
-        xValuesStat.clear();
+        ind numInStatWindow =
+            collectSamples<ValueSampling>(i, values[i].first, Window, nextVal, xValuesStat);
+
+        // Voxel-based samples within a plateau of equal values would repeat the same h.
+        // Record one row, once the whole plateau is swept.
+        if (!ValueSampling && BatchPlateaus) {
+            if (numInStatWindow) PlateauSamplePending = true;
+            if (!PlateauSamplePending || (i < maxIdx && values[i + 1].first == values[i].first))
+                continue;
+            PlateauSamplePending = false;
+            numInStatWindow = 1;
+            xValuesStat.assign(1, values[i].first);
+        }
 
-        // Find out if we need to write a sample.
-        if (propSampleType.get() == 1) {
-            // Sample equal bins, given bin size.
-            numInStatWindow = ((i - minIdx) % binSize == 0) ? 1 : 0;
-            // Value-based sample: We repeat samples when values do not occur
-        } else {
-            while (xValue < nextVal) {
-                numInStatWindow++;
-                xValuesStat.push_back(nextVal);
-                nextVal -= hStep;
+        bool createdOutput = false;
+
+        // Record statistics
+        for (ind copyBin = 0; copyBin < numInStatWindow; ++copyBin) {
+            if (ClusterStatsOutput &&
+                (ind)Stats.statH.size() - PreviousStatCacheSize == SampleIdClusters) {
+                // Cluster channels are indexed linearly, and so are the cluster ids.
+                const percolation::OrderedUnionFindView<TUnionFind, TOrdering> LinearUF(
+                    UF, Ordering, NumVertices);
+                createClusterOutput(&LinearUF, LinearUF.Linear(maxVolumeIndex),
+                                    LinearUF.LinearKeys(ExtentPerComponent),
+                                    LinearUF.LinearKeys(VolumePerComponent), latticeVertSize,
+                                    Settings, Clusters);
+                Clusters.ThresholdValue = static_cast<float>(xValuesStat[copyBin]);
+                createdOutput = true;
             }
+            appendSample(Stats, Settings, Window, xValuesStat[copyBin], (ind)UF.GetNumSets(),
+                         TotalVolume, maxVolume, percolating);
+        }
+        if (numInStatWindow && Pass.OnSample)
+            Pass.OnSample(i + 1, (TotalVolume > 0) ? maxVolume / TotalVolume : 0.0, percolating);
+
+        if (StopEarly && createdOutput) break;
+    }
+}
+
+template <typename T, typename TIndex, typename TVolumes>
+void PercolationAnalysis::sweepConcurrent(const std::pair<T, TIndex>* values,
+                                          const ind NumSorted, const ind NumVertices,
+                                          const TVolumes& Volumes,
+                                          const Connectivity& grid,
+                                          const GridPrimitive GridElemDim,
+                                          const SweepSettings& Settings, TStatCache& Stats,
+                                          ClusterResult& Clusters) const {
+    using UnionFindType = percolation::ConcurrentUnionFind<TIndex>;
+
+    const SampleWindow Window = computeSampleWindow(values, NumSorted, Settings);
+    const ind minIdx = Window.MinIdx;
+    const ind maxIdx = Window.MaxIdx;
+    const ind numSamples = Window.NumSamples;
+    // Adaptive sampling falls back to voxel-based samples here, same as the out-of-core sweep.
+    const bool ValueSampling = Settings.SampleType == 0;
+
+    // Find all sample positions up front. Between two of them, the order does not matter.
+    struct SamplePoint {
+        ind Index;
+        std::vector<double> H;
+    };
+    std::vector<SamplePoint> SamplePoints;
+    SamplePoints.reserve(numSamples);
+    {
+        std::vector<double> xValuesStat;
+        double nextVal = Window.MaxVal;
+        for (ind i = minIdx; i <= maxIdx; ++i) {
+            if (Settings.Progress && (i & 0xFFFF) == 0 && Settings.Progress->IsCancelled())
+                return;
+            const ind numInStatWindow =
+                ValueSampling
+                    ? collectSamples<true>(i, values[i].first, Window, nextVal, xValuesStat)
+                    : collectSamples<false>(i, values[i].first, Window, nextVal, xValuesStat);
+            if (numInStatWindow) SamplePoints.push_back({i, xValuesStat});
         }
+    }
 
-        // Always include the final index
-        if (i == maxIdx && !numInStatWindow) {
-            numInStatWindow = std::max(ind(1), numInStatWindow);
-            if (propSampleType.get() == 0) xValuesStat.push_back(minVal);
+    // One voxel-based sample per plateau of equal values, at its end. Same as the serial sweep.
+    if (!ValueSampling && Settings.BatchPlateaus) {
+        std::vector<SamplePoint> Batched;
+        Batched.reserve(SamplePoints.size());
+        for (const SamplePoint& Sample : SamplePoints) {
+            ind PlateauEnd = Sample.Index;
+            while (PlateauEnd < maxIdx && values[PlateauEnd + 1].first == values[PlateauEnd].first)
+                PlateauEnd++;
+            if (!Batched.empty() && Batched.back().Index == PlateauEnd) continue;
+            Batched.push_back({PlateauEnd, {static_cast<double>(values[PlateauEnd].first)}});
         }
+        SamplePoints.swap(Batched);
+    }
 
-        // Select an h value.
-        if (numInStatWindow && propSampleType.get() == 1) xValuesStat.push_back(xValue);
+    // Volumes are accumulated at the roots.
+    UnionFindType UF(NumVertices);
+    std::vector<double> VolumePerRoot(NumVertices, 0.0);
+    std::map<TIndex, Extent> ExtentPerComponent;
+    double TotalVolume = 0;
+
+    // - memory concerns
+    const ind PreviousStatCacheSize = (ind)Stats.statH.size();
+    Stats.reserve(Stats.size() + numSamples);
+
+    double maxVolume = 0;
+    TIndex maxVolumeIndex = UnionFindType::None;
+    bool percolating = false;
+
+    // Structured grid? Use to find out if percolating.
+    const StructuredGrid<3>* lattice = dynamic_cast<const StructuredGrid<3>*>(&grid);
+    std::array<ind, 3> latticeVertSize;
+    if (lattice) {
+        latticeVertSize = lattice->getNumVertices();
+    }
+
+    const percolation::CSRAdjacency* Adjacency =
+        (Settings.Adjacency && Settings.Adjacency->GetElementDim() == GridElemDim &&
+         Settings.Adjacency->GetNumElements() == NumVertices)
+            ? Settings.Adjacency.get()
+            : nullptr;
+
+    // Roots that got linked below another root while unioning one batch
+    std::vector<TIndex> LinkedRoots;
+    constexpr ind ConcurrentBatchSize = ind(1) << 20;
+
+    ind chunkBegin = 0;
+    for (const SamplePoint& Sample : SamplePoints) {
+        const ind chunkEnd = Sample.Index + 1;
+
+        // Large bins are inserted in batches, to report progress and to stop when cancelled.
+        // This does not change the result: Each edge is unioned from its later endpoint.
+        while (chunkBegin < chunkEnd) {
+            if (Settings.Progress) {
+                if (Settings.Progress->IsCancelled()) return;
+                Settings.Progress->Report(chunkBegin, maxIdx + 1, Stats);
+            }
+            const ind batchEnd = std::min(chunkEnd, chunkBegin + ConcurrentBatchSize);
+
+            // Insert all vertices of this batch first, so that their neighbors are present.
+#pragma omp parallel for reduction(+ : TotalVolume)
+            for (ind i = chunkBegin; i < batchEnd; ++i) {
+                UF.MakeSet(values[i].second);
+                TotalVolume += Volumes[values[i].second];
+            }
+
+            LinkedRoots.clear();
+#pragma omp parallel
+            {
+                std::vector<ind> Neighbors;
+                std::vector<TIndex> Linked;
+#pragma omp for schedule(dynamic, 1024)
+                for (ind i = chunkBegin; i < batchEnd; ++i) {
+                    const TIndex Current = values[i].second;
+
+                    const ind* NeighBegin;
+                    const ind* NeighEnd;
+                    if (Adjacency) {
+                        NeighBegin = Adjacency->NeighborsBegin(Current);
+                        NeighEnd = Adjacency->NeighborsEnd(Current);
+                    } else {
+                        grid.getConnections(Neighbors, Current, GridElemDim, GridElemDim);
+                        NeighBegin = Neighbors.data();
+                        NeighEnd = Neighbors.data() + Neighbors.size();
+                    }
+
+                    for (const ind* pNeigh = NeighBegin; pNeigh != NeighEnd; ++pNeigh) {
+                        const TIndex idNeigh = static_cast<TIndex>(*pNeigh);
+                        if (!UF.Contains(idNeigh)) continue;
+                        const TIndex LinkedRoot = UF.Union(Current, idNeigh);
+                        if (LinkedRoot != UnionFindType::None) Linked.push_back(LinkedRoot);
+                    }
+                }
+#pragma omp critical
+                LinkedRoots.insert(LinkedRoots.end(), Linked.begin(), Linked.end());
+            }
+
+            // Reconcile the volumes. Linked roots hand theirs to their new root,
+            // new vertices add their own. Only roots are written, so linked volumes stay valid.
+#pragma omp parallel for
+            for (ind k = 0; k < ind(LinkedRoots.size()); ++k) {
+                const TIndex Linked = LinkedRoots[k];
+                const double LinkedVolume = VolumePerRoot[Linked];
+                const TIndex Root = UF.Find(Linked);
+#pragma omp atomic
+                VolumePerRoot[Root] += LinkedVolume;
+            }
+
+#pragma omp parallel for
+            for (ind i = chunkBegin; i < batchEnd; ++i) {
+                const TIndex Root = UF.Find(values[i].second);
+                const double CurrentVolume = Volumes[values[i].second];
+#pragma omp atomic
+                VolumePerRoot[Root] += CurrentVolume;
+            }
+
+            // Largest component. Components only grow, and all grown ones contain a new vertex.
+            if (maxVolumeIndex != UnionFindType::None) maxVolumeIndex = UF.Find(maxVolumeIndex);
+#pragma omp parallel
+            {
+                double localMaxVolume = 0;
+                TIndex localMaxIndex = UnionFindType::None;
+#pragma omp for nowait
+                for (ind i = chunkBegin; i < batchEnd; ++i) {
+                    const TIndex Root = UF.Find(values[i].second);
+                    if (VolumePerRoot[Root] > localMaxVolume) {
+                        localMaxVolume = VolumePerRoot[Root];
+                        localMaxIndex = Root;
+                    }
+                }
+#pragma omp critical
+                if (localMaxVolume > maxVolume) {
+                    maxVolume = localMaxVolume;
+                    maxVolumeIndex = localMaxIndex;
+                }
+            }
+
+            // Extents and percolation
+            if (lattice) {
+                for (const TIndex Linked : LinkedRoots) {
+                    auto itLinked = ExtentPerComponent.find(Linked);
+                    if (itLinked == ExtentPerComponent.end()) continue;
+                    const Extent LinkedExtent = itLinked->second;
+                    ExtentPerComponent.erase(itLinked);
+                    ExtentPerComponent[UF.Find(Linked)].merge(LinkedExtent);
+                }
+                for (ind i = chunkBegin; i < batchEnd; ++i) {
+                    const TIndex Current = values[i].second;
+                    Extent& RootExtent = ExtentPerComponent[UF.Find(Current)];
+                    RootExtent.extend(StructuredGrid<3>::indexFromLinear(Current, latticeVertSize));
+                    if (!percolating && RootExtent.isPercolating(latticeVertSize, Settings.PercDim))
+                        percolating = true;
+                }
+            }
+
+            chunkBegin = batchEnd;
+        }
 
         bool createdOutput = false;
 
         // Record statistics
-        for (ind copyBin = 0; copyBin < numInStatWindow; ++copyBin) {
-            if (propClusterStatsOutput.get() &&
-                StatCache.statH.size() - PreviousStatCacheSize == propSampleIdClusters.get()) {
+        for (const double h : Sample.H) {
+            if (Settings.ClusterStatsOutput &&
+                Stats.statH.size() - PreviousStatCacheSize == Settings.SampleIdClusters) {
+                std::map<TIndex, double> VolumePerComponent;
+                for (ind id = 0; id < NumVertices; ++id) {
+                    if (UF.Find(static_cast<TIndex>(id)) == static_cast<TIndex>(id))
+                        VolumePerComponent[static_cast<TIndex>(id)] = VolumePerRoot[id];
+                }
                 createClusterOutput(&UF, maxVolumeIndex, ExtentPerComponent, VolumePerComponent,
-                                    latticeVertSize);
-                propThresholdValue.set(xValuesStat[copyBin]);
+                                    latticeVertSize, Settings, Clusters);
+                Clusters.ThresholdValue = static_cast<float>(h);
                 createdOutput = true;
             }
-            StatCache.RunID.push_back(RunID);
-            StatCache.statH.push_back(xValuesStat[copyBin]);
-            double normH = 1.0 - (xValuesStat[copyBin] - minVal) / (maxVal - minVal);
-            StatCache.normalizedH.push_back(normH);
-            StatCache.numComps.push_back((int)UF.GetNumSets());
-            double normVolume = (float)TotalVolume / NumVertices;
-            StatCache.normalizedCompVol.push_back(normVolume);
-            StatCache.totalCompVol.push_back((float)TotalVolume);
-            const double LargestCompVol = maxVolume;
-            StatCache.largestCompVol.push_back((float)LargestCompVol);
-            StatCache.isPercolating.push_back(percolating ? 1 : 0);
-        }
-
-        if (propStopEarly.get() && createdOutput) break;
-    }
-
-    // Prepare output data
-    auto pOutTable = std::make_shared<DataFrame>();
-    // - How many rows we have
-    const ind NumStatsRows = (ind)StatCache.statH.size();
-
-    // Add columns
-    auto pIterID = pOutTable->addColumn<int>("Iteration", NumStatsRows);
-    auto& IterID = pIterID->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatH = pOutTable->addColumn<float>("H", NumStatsRows);
-    auto& StatH = pStatH->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pNormalizedH = pOutTable->addColumn<float>("Value Fraction", NumStatsRows);
-    auto& NormalizedH =
-        pNormalizedH->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatNormVol = pOutTable->addColumn<float>("Normalized Volume", NumStatsRows);
-    auto& NormVol =
-        pStatNormVol->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatNumComp = pOutTable->addColumn<int>("Number of connected components", NumStatsRows);
-    auto& AllComp =
-        pStatNumComp->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatMaxComp =
-        pOutTable->addColumn<int>("Maximum number of connected components", NumStatsRows);
-    auto& MaxComp =
-        pStatMaxComp->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatNumCompRatio = pOutTable->addColumn<float>(
-        "Number of connected components / Maximum number of connected components", NumStatsRows);
-    auto& CompRatio =
-        pStatNumCompRatio->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatLargestCompVol =
-        pOutTable->addColumn<float>("Volume largest connected component", NumStatsRows);
-    auto& VolLargest =
-        pStatLargestCompVol->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatTotalVol = pOutTable->addColumn<float>("Total Volume", NumStatsRows);
-    auto& VolTotal =
-        pStatTotalVol->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-    // --
-    auto pStatVolumeRatio =
-        pOutTable->addColumn<float>("Largest volume / Total volume", NumStatsRows);
-    auto& VolRatio =
-        pStatVolumeRatio->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-
-    // --
-    auto pIsPercolating = pOutTable->addColumn<int>(
-        "Is percolating " + propPercDim.getSelectedDisplayName(), NumStatsRows);
-    auto& PercolatingState =
-        pIsPercolating->getTypedBuffer()->getEditableRAMRepresentation()->getDataContainer();
-
-    // Fill table
-    if (NumStatsRows > 0) {
-        auto itStartThisRun = StatCache.numComps.cbegin();
-        std::advance(itStartThisRun, PreviousStatCacheSize);
-        const int MaxNumConnectedComponents =
-            *(std::max_element(itStartThisRun, StatCache.numComps.cend()));
-
-        for (ind i(0); i < NumStatsRows; i++) {
-            IterID[i] = StatCache.RunID[i];
-            StatH[i] = StatCache.statH[i];
-            NormalizedH[i] = StatCache.normalizedH[i];
-            NormVol[i] = StatCache.normalizedCompVol[i];
-            AllComp[i] = StatCache.numComps[i];
-            CompRatio[i] = float(StatCache.numComps[i]) / float(MaxNumConnectedComponents);
-            MaxComp[i] = MaxNumConnectedComponents;
-            VolLargest[i] = StatCache.largestCompVol[i];
-            VolTotal[i] = StatCache.totalCompVol[i];
-            VolRatio[i] = StatCache.largestCompVol[i] / StatCache.totalCompVol[i];
-            PercolatingState[i] = StatCache.isPercolating[i];
+            appendSample(Stats, Settings, Window, h, (ind)UF.GetNumSets(), TotalVolume,
+                         maxVolume, percolating);
         }
+
+        if (Settings.StopEarly && createdOutput) break;
     }
+}
 
-    pOutTable->updateIndexBuffer();
-    // Throw out the data
-    portOutTable.setData(pOutTable);
+template <typename T>
+void PercolationAnalysis::sweepDownsampled(const DataChannel<T, 1>& data,
+                                           const DataChannel<double, 1>& volume,
+                                           const StructuredGrid<3>& lattice,
+                                           const percolation::Pooling pooling,
+                                           const SweepSettings& Settings, TStatCache& Stats) const {
+    const ind Factor = ind(1) << Settings.ResolutionLevel;
+    const SweepProgress* Progress = Settings.Progress;
+    auto isCancelled = [Progress]() { return Progress && Progress->IsCancelled(); };
+    auto Coarse = [&]() {
+        const percolation::ContiguousChannelData<T> DataValues(data);
+        const percolation::ContiguousChannelData<double> Volumes(volume);
+        return percolation::downsampleLattice(DataValues.data(), Volumes,
+                                              lattice.getNumVertices(), Factor, pooling,
+                                              isCancelled);
+    }();
+    if (isCancelled()) return;
+    const ind NumCoarse = static_cast<ind>(Coarse.Values.size());
+
+    // Keep periodicity of the input grid.
+    std::shared_ptr<const Connectivity> CoarseGrid;
+    if (const auto* periodic = dynamic_cast<const PeriodicGrid<3>*>(&lattice)) {
+        CoarseGrid = std::make_shared<PeriodicGrid<3>>(
+            Coarse.Size, std::array<bool, 3>({periodic->isPeriodic(0), periodic->isPeriodic(1),
+                                              periodic->isPeriodic(2)}));
+    } else {
+        CoarseGrid = std::make_shared<StructuredGrid<3>>(Coarse.Size);
+    }
 
-}  // namespace inviwo
+    BufferChannel<T, 1> CoarseData(NumCoarse, data.getName(), GridPrimitive::Vertex);
+    CoarseData.data() = std::move(Coarse.Values);
+    BufferChannel<double, 1> CoarseVolume(NumCoarse, volume.getName(), GridPrimitive::Vertex);
+    CoarseVolume.data() = std::move(Coarse.Volumes);
+
+    SweepSettings CoarseSettings = Settings;
+    CoarseSettings.ClusterStatsOutput = false;
+    CoarseSettings.OutOfCore = false;
+    CoarseSettings.Adjacency = nullptr;
+    // A channel mask has the fine resolution. Masked blocks pool to the sentinel, and are cut off.
+    if (CoarseSettings.MaskSource == percolation::MaskSource::Channel)
+        CoarseSettings.MaskSource = percolation::MaskSource::None;
+    ClusterResult NoClusters;
+    processChannel(CoarseData, CoarseVolume, *CoarseGrid, CoarseSettings, Stats, NoClusters);
+}
 
-inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
-                                                     const ind maxClusterId,
-                                                     const std::map<ind, Extent>& extends,
-                                                     const std::map<ind, double>& volumes,
-                                                     const std::array<ind, 3>& totalSize) {
+template <typename TUnionFind, typename TIndex>
+void PercolationAnalysis::createClusterOutput(const TUnionFind* clusters,
+                                              const TIndex maxClusterId,
+                                              const std::map<TIndex, Extent>& extends,
+                                              const std::map<TIndex, double>& volumes,
+                                              const std::array<ind, 3>& totalSize,
+                                              const SweepSettings& Settings,
+                                              ClusterResult& Clusters) const {
+    using UnionFindType = TUnionFind;
 
-    auto pInDataSet = portInData.getData();
-    ind NumVertices = propScalarChannel.getCurrentChannel()->size();
+    const auto& pInDataSet = Settings.InDataSet;
+    if (!pInDataSet) return;
+    const ind NumVertices = static_cast<ind>(clusters->GetNumElements());
 
     // Channel for marking clusters
     auto outData = std::make_shared<DataSet>(*pInDataSet.get());
@@ -616,7 +1832,7 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
 
     std::shared_ptr<BufferChannel<float, 1>> localGLobalClusterChannel;
     std::shared_ptr<BufferChannel<float, 1>> distributionTypeChannel;
-    if (propLocalGlobalStats.get()) {
+    if (Settings.LocalGlobalStats) {
         localGLobalClusterChannel = std::make_shared<BufferChannel<float, 1>>(
             NumVertices, "Local/GLobal Clusters", GridPrimitive::Vertex);
         distributionTypeChannel = std::make_shared<BufferChannel<float, 1>>(
@@ -624,9 +1840,9 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
     }
 
     // Set of all current clusters ids
-    std::map<ind, bool> clusterIdsLocal;
+    std::map<TIndex, bool> clusterIdsLocal;
 
-    clusterIdsLocal[-1] = false;
+    clusterIdsLocal[UnionFindType::None] = false;
 
     bool isLocal = true;
     std::vector<ind> idxVec;
@@ -637,12 +1853,14 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
     ind numLocalVoxels = 0;
     ind numGlobalVoxels = 0;
 
-    size3_t blockSize = propBlockSize.get();
+    const size3_t blockSize = Settings.BlockSize;
     for (ind dIdx = 0; dIdx < NumVertices; ++dIdx) {
-        ind clusterId = clusters->Find(dIdx);
+        const TIndex clusterId = clusters->Find(static_cast<TIndex>(dIdx));
+        const bool inCluster = clusterId != UnionFindType::None;
+        const bool inLargest = inCluster && clusterId == maxClusterId;
 
         // Already in the map? (If not, add)
-        if (propLocalGlobalStats.get()) {
+        if (Settings.LocalGlobalStats) {
             auto found = clusterIdsLocal.find(clusterId);
             if (found == clusterIdsLocal.end()) {
                 // Check if the cluster is local
@@ -703,9 +1921,9 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
                 isLocal = found->second;
             }
 
-            localGLobalClusterChannel->get(dIdx) = clusterId < 0 ? 0.0f : (isLocal ? -1.0f : 1.0f);
+            localGLobalClusterChannel->get(dIdx) = !inCluster ? 0.0f : (isLocal ? -1.0f : 1.0f);
 
-            if (clusterId >= 0) {
+            if (inCluster) {
                 numGlobalVoxels += isLocal ? 0 : 1;
                 numLocalVoxels += isLocal ? 1 : 0;
             }
@@ -737,27 +1955,27 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
             distributionTypeChannel->get(dIdx) = (isPosLocal ? -1.0f : 1.0f);
         }
 
-        largestClusterChannel->get(dIdx) = clusterId == maxClusterId ? 1.0f : 0.0f;
-        allClustersChannel->get(dIdx) =
-            clusterId < 0 ? 0.0f : (clusterId == maxClusterId ? -1.0f : 1.0f);
-        clusterIdChannel->get(dIdx) = static_cast<float>(clusterId);
+        largestClusterChannel->get(dIdx) = inLargest ? 1.0f : 0.0f;
+        allClustersChannel->get(dIdx) = !inCluster ? 0.0f : (inLargest ? -1.0f : 1.0f);
+        clusterIdChannel->get(dIdx) = inCluster ? static_cast<float>(clusterId) : -1.0f;
     }
 
     outData->addChannel(largestClusterChannel);
     outData->addChannel(allClustersChannel);
     outData->addChannel(clusterIdChannel);
-    if (propLocalGlobalStats.get()) {
+    if (Settings.LocalGlobalStats) {
         outData->addChannel(localGLobalClusterChannel);
-        propGlobalClusterPercentage.set(100.0f * static_cast<float>(numGlobalClusters) /
-                                        (numGlobalClusters + numLocalClusters));
-        propGlobalVoxelPercentage.set(100.0f * static_cast<float>(numGlobalVoxels) /
-                                      (numGlobalVoxels + numLocalVoxels));
+        Clusters.HasLocalGlobalStats = true;
+        Clusters.GlobalClusterPercentage = 100.0f * static_cast<float>(numGlobalClusters) /
+                                           (numGlobalClusters + numLocalClusters);
+        Clusters.GlobalVoxelPercentage =
+            100.0f * static_cast<float>(numGlobalVoxels) / (numGlobalVoxels + numLocalVoxels);
         outData->addChannel(distributionTypeChannel);
     }
 
-    portOutClusters.setData(outData);
+    Clusters.Clusters = outData;
 
-    if (propClusterStatsOutput.get()) {
+    if (Settings.ClusterStatsOutput) {
 
         // Setup dataframe for cluster stats
         auto pOutClusterStats = std::make_shared<DataFrame>();
@@ -788,8 +2006,8 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
 
         ind statIndex = 0;
         for (auto pair : clusterIdsLocal) {
-            ind clusterId = pair.first;
-            if (clusterId < 0) continue;
+            const TIndex clusterId = pair.first;
+            if (clusterId == UnionFindType::None) continue;
             clusterIds[statIndex] = static_cast<int>(clusterId);
             volume[statIndex] = static_cast<float>(volumes.find(clusterId)->second);
             const Extent& extend = extends.find(clusterId)->second;
@@ -800,7 +2018,7 @@ inline void PercolationAnalysis::createClusterOutput(const UnionFind* clusters,
             statIndex++;
         }
 
-        portOutClusterStatistics.setData(pOutClusterStats);
+        Clusters.Statistics = pOutClusterStats;
     }
 }
 
@@ -0,0 +1,202 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <percolation/processors/percolationcacheloader.h>
+#include <percolation/util/channelmetadata.h>
+#include <modules/discretedata/dataset.h>
+#include <modules/discretedata/channels/analyticchannel.h>
+#include <modules/discretedata/channels/bufferchannel.h>
+#include <modules/discretedata/connectivity/periodicgrid.h>
+#include <modules/kxtools/performancetimer.h>
+#include <inviwo/core/util/filesystem.h>
+
+namespace inviwo {
+using namespace discretedata;
+using percolation::cachefile::SectionKind;
+
+// The Class Identifier has to be globally unique. Use a reverse DNS naming scheme
+const ProcessorInfo PercolationCacheLoader::processorInfo_{
+    "org.inviwo.PercolationCacheLoader",  // Class identifier
+    "Percolation Cache Loader",           // Display name
+    "Percolation",                        // Category
+    CodeState::Experimental,              // Code state
+    Tags::None,                           // Tags
+};
+
+const ProcessorInfo PercolationCacheLoader::getProcessorInfo() const { return processorInfo_; }
+
+PercolationCacheLoader::PercolationCacheLoader()
+    : Processor()
+    , portOutData("OutData")
+    , cacheFile("cacheFile", "Cache File")
+    , checkSources("checkSources", "Check Source Files", true)
+    , reloadButton("reload", "Reload") {
+    addPort(portOutData);
+    addProperty(cacheFile);
+    addProperty(checkSources);
+    addProperty(reloadButton);
+
+    cacheFile.setAcceptMode(AcceptMode::Open);
+    reloadButton.onChange([&]() { ReloadRequested = true; });
+}
+
+void PercolationCacheLoader::process() {
+    const bool Reload = ReloadRequested;
+    ReloadRequested = false;
+
+    const std::string& FileName = cacheFile.get();
+    if (!filesystem::fileExists(FileName)) {
+        LogWarn("Cache file " << FileName << " not found.");
+        data_ = nullptr;
+        portOutData.clear();
+        return;
+    }
+
+    PerformanceTimer Timer;
+    percolation::CacheFileReader Reader;
+    if (!Reader.Open(FileName)) {
+        data_ = nullptr;
+        portOutData.clear();
+        return;
+    }
+
+    // The cached data is only as current as the files it was derived from.
+    if (checkSources.get()) {
+        const auto Outdated = Reader.GetOutdatedSources();
+        if (!Outdated.empty()) {
+            LogWarn("The cache file is outdated, " << Outdated.size()
+                                                    << " source files changed, e.g., "
+                                                    << Outdated.front()
+                                                    << ". Please write it anew.");
+            data_ = nullptr;
+            portOutData.clear();
+            return;
+        }
+    }
+
+    // Same file as before, nothing to read unless asked to.
+    const std::time_t ModificationTime = filesystem::fileModificationTime(FileName);
+    if (data_ && !Reload && FileName == LoadedFile && ModificationTime == LoadedTime) {
+        portOutData.setData(data_);
+        return;
+    }
+
+    data_ = loadCache(Reader);
+    if (!data_) {
+        LogWarn("The cache file " << FileName << " is incomplete or damaged.");
+        portOutData.clear();
+        return;
+    }
+    LoadedFile = FileName;
+    LoadedTime = ModificationTime;
+    LogInfo("Loading the cache file took " << Timer.ElapsedTime() << " seconds.");
+
+    portOutData.setData(data_);
+}
+
+std::shared_ptr<DataSet> PercolationCacheLoader::loadCache(
+    const percolation::CacheFileReader& reader) const {
+    const std::array<ind, 3> Dims = reader.GetDims();
+    const ind NumVertices = Dims[0] * Dims[1] * Dims[2];
+    auto dataSet =
+        std::make_shared<DataSet>(std::make_shared<PeriodicGrid<3>>(Dims, reader.GetPeriodic()));
+
+    // A section of one value per vertex, decoded straight into a buffer of its own type.
+    auto readBuffer = [&reader, NumVertices](const auto* section,
+                                             auto value) -> std::shared_ptr<Channel> {
+        using T = decltype(value);
+        if (!section || static_cast<ind>(section->NumElements) != NumVertices ||
+            section->Type !=
+                static_cast<std::uint32_t>(percolation::cachefile::ElementTypeOf<T>::Type))
+            return nullptr;
+        auto Buffer = std::make_shared<BufferChannel<T, 1>>(
+            NumVertices, percolation::CacheFileReader::GetName(*section), GridPrimitive::Vertex);
+        if (!reader.Read(*section, reinterpret_cast<char*>(Buffer->data().data())))
+            return nullptr;
+        return Buffer;
+    };
+
+    // Values along the three axes
+    auto readAxes = [&reader, &Dims](const SectionKind (&kinds)[3],
+                                     std::array<std::vector<double>, 3>& values) {
+        for (int axis = 0; axis < 3; ++axis) {
+            const auto* Section = reader.FindSection(kinds[axis]);
+            if (!Section || static_cast<ind>(Section->NumElements) != Dims[axis] ||
+                !reader.Read(*Section, values[axis]))
+                return false;
+        }
+        return true;
+    };
+
+    // Scalar in its stored precision
+    const auto* ScalarSection = reader.FindSection(SectionKind::Scalar);
+    if (!ScalarSection) return nullptr;
+    const auto ScalarType = static_cast<percolation::cachefile::ElementType>(ScalarSection->Type);
+    const auto Scalar = (ScalarType == percolation::cachefile::ElementType::Float32)
+                            ? readBuffer(ScalarSection, float(0))
+                            : readBuffer(ScalarSection, double(0));
+    if (!Scalar) return nullptr;
+    percolation::addSourceFiles(*Scalar, reader.GetSources());
+    dataSet->addChannel(Scalar);
+
+    // Sorted order, in the index type it was stored with
+    if (const auto* OrderSection = reader.FindSection(SectionKind::Order)) {
+        const auto Order = (OrderSection->ElementSize == sizeof(int))
+                               ? readBuffer(OrderSection, int(0))
+                               : readBuffer(OrderSection, ind(0));
+        if (!Order) return nullptr;
+        dataSet->addChannel(Order);
+    }
+
+    // Positions of a rectilinear grid, evaluated on access
+    std::array<std::vector<double>, 3> Coords;
+    if (reader.FindSection(SectionKind::AxisX)) {
+        if (!readAxes({SectionKind::AxisX, SectionKind::AxisY, SectionKind::AxisZ}, Coords))
+            return nullptr;
+        dataSet->addChannel(std::make_shared<AnalyticChannel<double, 3, std::array<double, 3>>>(
+            [Coords, Dims](std::array<double, 3>& pos, ind idx) {
+                pos[0] = Coords[0][idx % Dims[0]];
+                pos[1] = Coords[1][(idx / Dims[0]) % Dims[1]];
+                pos[2] = Coords[2][idx / (Dims[0] * Dims[1])];
+            },
+            NumVertices, "Vertex Positions", GridPrimitive::Vertex));
+    }
+
+    // Volume: constant, product of widths per axis, or one value per vertex
+    if (const auto* WidthSection = reader.FindSection(SectionKind::VolumeWidthX)) {
+        std::array<std::vector<double>, 3> Widths;
+        if (!readAxes({SectionKind::VolumeWidthX, SectionKind::VolumeWidthY,
+                       SectionKind::VolumeWidthZ},
+                      Widths))
+            return nullptr;
+        dataSet->addChannel(std::make_shared<AnalyticChannel<double, 1, double>>(
+            [Widths, Dims](double& val, ind idx) {
+                val = Widths[0][idx % Dims[0]] * Widths[1][(idx / Dims[0]) % Dims[1]] *
+                      Widths[2][idx / (Dims[0] * Dims[1])];
+            },
+            NumVertices, percolation::CacheFileReader::GetName(*WidthSection),
+            GridPrimitive::Vertex));
+    } else if (const auto* VolumeSection = reader.FindSection(SectionKind::Volume)) {
+        std::vector<double> Constant;
+        if (VolumeSection->NumElements == 1 && reader.Read(*VolumeSection, Constant)) {
+            const double Value = Constant[0];
+            dataSet->addChannel(std::make_shared<AnalyticChannel<double, 1, double>>(
+                [Value](double& val, ind) { val = Value; }, NumVertices,
+                percolation::CacheFileReader::GetName(*VolumeSection), GridPrimitive::Vertex));
+        } else {
+            const auto Volume = readBuffer(VolumeSection, double(0));
+            if (!Volume) return nullptr;
+            dataSet->addChannel(Volume);
+        }
+    } else {
+        return nullptr;
+    }
+
+    return dataSet;
+}
+
+}  // namespace inviwo
@@ -0,0 +1,84 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <inviwo/core/processors/processor.h>
+#include <inviwo/core/properties/boolproperty.h>
+#include <inviwo/core/properties/buttonproperty.h>
+#include <inviwo/core/properties/fileproperty.h>
+#include <modules/discretedata/ports/datasetport.h>
+#include <percolation/util/percolationcache.h>
+
+#include <ctime>
+
+namespace inviwo {
+using namespace discretedata;
+
+/** \docpage{org.inviwo.PercolationCacheLoader, Percolation Cache Loader}
+    ![](org.inviwo.PercolationCacheLoader.png?classIdentifier=org.inviwo.PercolationCacheLoader)
+
+    Reads a file written by the Percolation Cache Writer.
+
+    ### Outports
+      * __OutData__ Lattice with the scalar, the volume, the vertex positions if the grid
+        is rectilinear, and the sorted order of the scalar if it was stored.
+
+    ### Properties
+      * __Cache File__ File to read.
+      * __Check Source Files__ Refuse the file if any of its source files changed since.
+      * __Reload__ Checks the source files again, and reads the file anew.
+*/
+
+/** \class PercolationCacheLoader
+    \brief Reads a percolation-ready dataset from a cache file.
+
+    The file is mapped and its chunks are decoded in parallel, each checked against its checksum.
+    The sorted order is passed on as a channel, the analysis then skips sorting.
+    Positions and separable volumes are evaluated on access from their values per axis.
+*/
+class IVW_MODULE_PERCOLATION_API PercolationCacheLoader : public Processor {
+    // Construction / Deconstruction
+public:
+    PercolationCacheLoader();
+    virtual ~PercolationCacheLoader() = default;
+
+    // Methods
+public:
+    virtual const ProcessorInfo getProcessorInfo() const override;
+    static const ProcessorInfo processorInfo_;
+
+protected:
+    /// Our main computation function
+    virtual void process() override;
+
+    /// Builds the dataset from an opened file. Null if a section is missing or damaged.
+    std::shared_ptr<DataSet> loadCache(const percolation::CacheFileReader& reader) const;
+
+    // Ports
+public:
+    DataSetOutport portOutData;
+
+    // Properties
+public:
+    FileProperty cacheFile;
+    BoolProperty checkSources;
+    ButtonProperty reloadButton;
+
+    // Attributes
+private:
+    std::shared_ptr<DataSet> data_;
+    /// File and modification time data_ was read from
+    std::string LoadedFile;
+    std::time_t LoadedTime = 0;
+    /// Set by the reload button, skips the check for an unchanged file
+    bool ReloadRequested = false;
+};
+
+}  // namespace inviwo
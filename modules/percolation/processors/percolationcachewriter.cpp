@@ -0,0 +1,223 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <percolation/processors/percolationcachewriter.h>
+#include <percolation/util/channelaccess.h>
+#include <percolation/util/channelmetadata.h>
+#include <percolation/util/percolationcache.h>
+#include <percolation/util/rectilineargrid.h>
+#include <percolation/util/sortedorder.h>
+#include <modules/discretedata/dataset.h>
+#include <modules/discretedata/connectivity/periodicgrid.h>
+#include <modules/kxtools/performancetimer.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace inviwo {
+using namespace discretedata;
+
+// The Class Identifier has to be globally unique. Use a reverse DNS naming scheme
+const ProcessorInfo PercolationCacheWriter::processorInfo_{
+    "org.inviwo.PercolationCacheWriter",  // Class identifier
+    "Percolation Cache Writer",           // Display name
+    "Percolation",                        // Category
+    CodeState::Experimental,              // Code state
+    Tags::None,                           // Tags
+};
+
+const ProcessorInfo PercolationCacheWriter::getProcessorInfo() const { return processorInfo_; }
+
+PercolationCacheWriter::PercolationCacheWriter()
+    : Processor()
+    , portInData("InData")
+    , cacheFile("cacheFile", "Cache File")
+    , scalarChannel(portInData, "scalarChannel", "Scalar",
+                    [](const std::shared_ptr<const Channel> a) {
+                        return (a->getGridPrimitiveType() == GridPrimitive::Vertex &&
+                                a->getNumComponents() == 1);
+                    })
+    , volumeChannel(portInData, "volumeChannel", "Volume",
+                    [](const std::shared_ptr<const Channel> a) {
+                        return (a->getGridPrimitiveType() == GridPrimitive::Vertex &&
+                                a->getNumComponents() == 1);
+                    })
+    , storeOrder("storeOrder", "Store Sorted Order", true)
+    , compress("compress", "Compress", true)
+    , writeButton("write", "Write") {
+    addPort(portInData);
+    addProperty(cacheFile);
+    addProperty(scalarChannel);
+    addProperty(volumeChannel);
+    addProperty(storeOrder);
+    addProperty(compress);
+    addProperty(writeButton);
+
+    cacheFile.setAcceptMode(AcceptMode::Save);
+    writeButton.onChange([&]() { WriteRequested = true; });
+}
+
+void PercolationCacheWriter::process() {
+    if (!WriteRequested) return;
+    WriteRequested = false;
+
+    auto InData = portInData.getData();
+    if (!InData) return;
+
+    auto Scalar = scalarChannel.getCurrentChannel();
+    auto Volume = std::dynamic_pointer_cast<const DataChannel<double, 1>, const Channel>(
+        volumeChannel.getCurrentChannel());
+    if (!Scalar || !Volume || Volume->size() != Scalar->size()) {
+        LogWarn("Need a scalar and a double volume per vertex.");
+        return;
+    }
+    if (cacheFile.get().empty()) {
+        LogWarn("No cache file given.");
+        return;
+    }
+
+    PerformanceTimer Timer;
+    if (!writeCache(*InData, *Scalar, *Volume)) {
+        LogWarn("Could not write " << cacheFile.get() << ".");
+        return;
+    }
+    LogInfo("Writing the cache file took " << Timer.ElapsedTime() << " seconds.");
+}
+
+namespace {
+/// Writes the scalar and, if so desired, the order in which the sweep visits its vertices.
+template <typename T>
+bool writeScalar(percolation::CacheFileWriter& writer, const DataChannel<T, 1>& scalar,
+                 const ind numVertices, const bool storeOrder) {
+    using percolation::cachefile::SectionKind;
+    const percolation::ContiguousChannelData<T> Values(scalar);
+    if (!writer.AddSection(SectionKind::Scalar, scalar.getName(), Values.data(), numVertices))
+        return false;
+    if (!storeOrder) return true;
+
+    // Indices as small as the lattice allows, as the sweep uses them.
+    const std::string OrderName = percolation::sortedOrderName(scalar.getName());
+    if (numVertices <= std::numeric_limits<int>::max()) {
+        const auto Order = percolation::computeSortedOrder<int>(Values, numVertices);
+        return writer.AddSection(SectionKind::Order, OrderName, Order.data(), numVertices);
+    }
+    const auto Order = percolation::computeSortedOrder<ind>(Values, numVertices);
+    return writer.AddSection(SectionKind::Order, OrderName, Order.data(), numVertices);
+}
+}  // namespace
+
+bool PercolationCacheWriter::writeCache(const DataSet& data, const Channel& scalar,
+                                        const DataChannel<double, 1>& volume) {
+    using percolation::cachefile::SectionKind;
+
+    const auto* Lattice = dynamic_cast<const StructuredGrid<3>*>(data.getGrid().get());
+    if (!Lattice) {
+        LogWarn("Only structured grids can be cached.");
+        return false;
+    }
+    const std::array<ind, 3> Dims = Lattice->getNumVertices();
+    const size3_t Size(Dims[0], Dims[1], Dims[2]);
+    const ind NumVertices = Dims[0] * Dims[1] * Dims[2];
+    if (NumVertices == 0 || scalar.size() != NumVertices) {
+        LogWarn("The scalar is not given per lattice vertex.");
+        return false;
+    }
+    const auto* Float = dynamic_cast<const DataChannel<float, 1>*>(&scalar);
+    const auto* Double = dynamic_cast<const DataChannel<double, 1>*>(&scalar);
+    if (!Float && !Double) {
+        LogWarn("Only float and double scalars can be cached.");
+        return false;
+    }
+
+    std::array<bool, 3> Periodic = {false, false, false};
+    if (const auto* PerGrid = dynamic_cast<const PeriodicGrid<3>*>(Lattice))
+        for (int axis = 0; axis < 3; ++axis) Periodic[axis] = PerGrid->isPeriodic(axis);
+
+    // Written to a temporary file. It replaces the cache file on Close, and is removed
+    // when returning early.
+    percolation::CacheFileWriter Writer;
+    if (!Writer.Open(cacheFile.get(), Dims, Periodic)) return false;
+    Writer.SetCompression(compress.get());
+
+    // Everything the channels were derived from. The loader checks these for changes.
+    auto Positions = data.getChannel<double, 3>("Vertex Positions", GridPrimitive::Vertex);
+    std::vector<std::string> Sources = percolation::getSourceFiles(scalar);
+    for (const Channel* Derived : {static_cast<const Channel*>(&volume),
+                                   static_cast<const Channel*>(Positions.get())}) {
+        if (!Derived) continue;
+        for (const auto& Name : percolation::getSourceFiles(*Derived))
+            if (std::find(Sources.begin(), Sources.end(), Name) == Sources.end())
+                Sources.push_back(Name);
+    }
+    if (Sources.empty())
+        LogWarn("No source files are known. The cache file is never considered outdated.");
+    for (const auto& Name : Sources) Writer.AddSource(Name);
+
+    // Scalar and its sweep order
+    bool Written = Float ? writeScalar(Writer, *Float, NumVertices, storeOrder.get())
+                         : writeScalar(Writer, *Double, NumVertices, storeOrder.get());
+    if (!Written) return false;
+
+    // Coordinates of a rectilinear grid
+    std::array<std::vector<double>, 3> Axes;
+    const bool Rectilinear =
+        Positions && percolation::rectilinearAxes(*Positions, Size, true, Axes);
+    if (Positions && !Rectilinear)
+        LogWarn("The vertex positions are not rectilinear and are not cached.");
+    if (Rectilinear) {
+        const SectionKind AxisKinds[3] = {SectionKind::AxisX, SectionKind::AxisY,
+                                          SectionKind::AxisZ};
+        for (int axis = 0; axis < 3; ++axis)
+            Written = Written && Writer.AddSection(AxisKinds[axis], "Vertex Positions",
+                                                   Axes[axis].data(), Axes[axis].size());
+    }
+
+    // Volume: one value if constant, one width per vertex and axis if it is the product of the
+    // dual cell widths, as the raw loader computes it. Otherwise all of it.
+    double First = 0;
+    volume.fill(First, 0);
+    bool Constant = true;
+#pragma omp parallel for reduction(&& : Constant)
+    for (ind idx = 0; idx < NumVertices; ++idx) {
+        double Value;
+        volume.fill(Value, idx);
+        Constant = Constant && Value == First;
+    }
+
+    std::array<std::vector<double>, 3> Widths;
+    bool Separable = Rectilinear && !Constant;
+    if (Separable) {
+        for (int axis = 0; axis < 3; ++axis)
+            Widths[axis] = percolation::dualWidths(Axes[axis], Periodic[axis]);
+#pragma omp parallel for reduction(&& : Separable)
+        for (ind idx = 0; idx < NumVertices; ++idx) {
+            double Value;
+            volume.fill(Value, idx);
+            Separable = Separable && Value == Widths[0][idx % Dims[0]] *
+                                                 Widths[1][(idx / Dims[0]) % Dims[1]] *
+                                                 Widths[2][idx / (Dims[0] * Dims[1])];
+        }
+    }
+
+    if (Constant) {
+        Written = Written && Writer.AddSection(SectionKind::Volume, volume.getName(), &First, 1);
+    } else if (Separable) {
+        const SectionKind WidthKinds[3] = {SectionKind::VolumeWidthX, SectionKind::VolumeWidthY,
+                                           SectionKind::VolumeWidthZ};
+        for (int axis = 0; axis < 3; ++axis)
+            Written = Written && Writer.AddSection(WidthKinds[axis], volume.getName(),
+                                                   Widths[axis].data(), Widths[axis].size());
+    } else {
+        const percolation::ContiguousChannelData<double> Volumes(volume);
+        Written = Written && Writer.AddSection(SectionKind::Volume, volume.getName(),
+                                               Volumes.data(), NumVertices);
+    }
+
+    return Written && Writer.Close();
+}
+
+}  // namespace inviwo
@@ -0,0 +1,86 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <inviwo/core/processors/processor.h>
+#include <inviwo/core/properties/boolproperty.h>
+#include <inviwo/core/properties/buttonproperty.h>
+#include <inviwo/core/properties/fileproperty.h>
+#include <modules/discretedata/ports/datasetport.h>
+#include <modules/discretedata/properties/datachannelproperty.h>
+
+namespace inviwo {
+using namespace discretedata;
+
+/** \docpage{org.inviwo.PercolationCacheWriter, Percolation Cache Writer}
+    ![](org.inviwo.PercolationCacheWriter.png?classIdentifier=org.inviwo.PercolationCacheWriter)
+
+    Writes everything a percolation analysis needs into one cache file,
+    to be read back by the Percolation Cache Loader instead of loading and transforming anew.
+
+    ### Inports
+      * __InData__ Lattice with a percolation scalar and a volume.
+
+    ### Properties
+      * __Cache File__ File to write.
+      * __Scalar__ Percolation scalar, float or double.
+      * __Volume__ Volume per vertex.
+      * __Store Sorted Order__ Also store the order of the sweep, so it is not sorted again.
+      * __Compress__ Compress chunks where that makes them smaller.
+      * __Write__ Writes the file.
+*/
+
+/** \class PercolationCacheWriter
+    \brief Writes a percolation-ready dataset into a cache file.
+
+    Holds the lattice size and periodicity, the scalar, the volume,
+    the coordinates if the grid is rectilinear, and optionally the sorted order.
+    Separable and constant volumes are stored per axis or as one value.
+    The source files recorded with the channels are stored with their modification times.
+*/
+class IVW_MODULE_PERCOLATION_API PercolationCacheWriter : public Processor {
+    // Construction / Deconstruction
+public:
+    PercolationCacheWriter();
+    virtual ~PercolationCacheWriter() = default;
+
+    // Methods
+public:
+    virtual const ProcessorInfo getProcessorInfo() const override;
+    static const ProcessorInfo processorInfo_;
+
+protected:
+    /// Our main computation function
+    virtual void process() override;
+
+    /// Writes the cache file. Returns false if anything could not be written.
+    bool writeCache(const DataSet& data, const Channel& scalar,
+                    const DataChannel<double, 1>& volume);
+
+    // Ports
+public:
+    DataSetInport portInData;
+
+    // Properties
+public:
+    FileProperty cacheFile;
+    DataChannelProperty scalarChannel;
+    DataChannelProperty volumeChannel;
+    BoolProperty storeOrder;
+    BoolProperty compress;
+    ButtonProperty writeButton;
+
+    // Attributes
+private:
+    /// Only a press of the button writes, not every change of the input.
+    bool WriteRequested = false;
+};
+
+}  // namespace inviwo
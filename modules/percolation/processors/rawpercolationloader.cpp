@@ -9,13 +9,17 @@
  */
 
 #include <percolation/processors/rawpercolationloader.h>
+#include <percolation/util/channelmetadata.h>
+#include <percolation/util/rawcomponentfile.h>
+#include <percolation/util/rectilineargrid.h>
 #include <modules/discretedata/dataset.h>
 #include <modules/discretedata/connectivity/periodicgrid.h>
 #include <modules/discretedata/connectivity/elementiterator.h>
 #include <modules/kxtools/performancetimer.h>
 #include <inviwo/core/util/filesystem.h>
 #include <modules/discretedata/connectivity/euclideanmeasure.h>
-#include <fstream>
+#include <future>
+#include <sstream>
 
 #ifndef __clang__
 #include <omp.h>
@@ -41,290 +45,615 @@ RawPercolationLoader::RawPercolationLoader()
     , folderName("fileName", "File Name")
     , timeSlice("timeSlice", "Time Slice", 1, 1, 71)
     , fieldSize("fieldSize", "Field Size", size3_t(100), size3_t(0), size3_t(10000))
+    , roiOffset("roiOffset", "ROI Offset", size3_t(0), size3_t(0), size3_t(10000))
+    , roiExtent("roiExtent", "ROI Extent", size3_t(0), size3_t(0), size3_t(10000))
+    , roiStride("roiStride", "ROI Stride", size3_t(1), size3_t(1), size3_t(100))
     , periodicX("periodicX", "X Periodic")
     , periodicY("periodicY", "Y Periodic")
     , periodicZ("periodicZ", "Z Periodic")
-    , noHeader("noHeader", "Velocity without Header")
     , fullGrid("fullGrid", "All Vertex Postions given", true)
-    , constVolume("constVolume", "Constant Volume", true) {
+    , constVolume("constVolume", "Constant Volume", true)
+    , storagePrecision("storagePrecision", "Storage Precision",
+                       {{"double", "Double", percolation::StoragePrecision::Double},
+                        {"float", "Float", percolation::StoragePrecision::Float}},
+                       0)
+    , cacheSize("cacheSize", "Cached Time Slices", 1, 1, 71, 1, InvalidationLevel::Valid)
+    , prefetchNext("prefetchNext", "Prefetch Next Slice", false, InvalidationLevel::Valid)
+    , timeRange("timeRange", "Time Slice Range", 1, 71, 1, 71, 1, 0, InvalidationLevel::Valid)
+    , runTimeSlices("runTimeSlices", "Run Time Slices", InvalidationLevel::Valid)
+    , SliceCache(1)
+    , StaticCache(1)
+    , Lifetime(std::make_shared<int>(0)) {
     addPort(portOutData);
     addProperty(folderName);
     addProperty(fieldSize);
+    addProperty(roiOffset);
+    addProperty(roiExtent);
+    addProperty(roiStride);
     addProperty(timeSlice);
     addProperty(periodicX);
     addProperty(periodicY);
     addProperty(periodicZ);
-    addProperty(noHeader);
     addProperty(fullGrid);
     addProperty(constVolume);
+    addProperty(storagePrecision);
+    addProperty(cacheSize);
+    addProperty(prefetchNext);
+    addProperty(timeRange);
+    addProperty(runTimeSlices);
 
     folderName.setAcceptMode(AcceptMode::Open);
     folderName.setFileMode(FileMode::DirectoryOnly);
+
+    cacheSize.onChange([&]() {
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        if (!RunningTimeSlices) SliceCache.SetMaxCacheSize(cacheSize.get());
+    });
+
+    runTimeSlices.onChange([&]() {
+        if (RunningTimeSlices)
+            stopTimeSlices();
+        else
+            startTimeSlices();
+    });
 }
 
-double* RawPercolationLoader::loadComponent(const std::string& filename,
-                                            const ivec3 expectedFileSize, const ind header,
-                                            double* pData, bool is2D) {
-    // Load file
-    if (!filesystem::fileExists(filename)) return nullptr;
+RawPercolationLoader::~RawPercolationLoader() {
+    Lifetime.reset();
+    // The background load refers to this processor.
+    if (Prefetch.valid()) Prefetch.wait();
+}
 
-    std::ifstream file(filename, std::ios::binary);
+void RawPercolationLoader::startTimeSlices() {
+    RunningTimeSlices = true;
+    runTimeSlices.setDisplayName("Running Time Slices...  Press to Stop");
 
-    ind dataSize = expectedFileSize.x * expectedFileSize.y;
-    if (!is2D) {
-        dataSize *= expectedFileSize.z;
+    // The current slice is cached, the next one prefetched. Older ones are dropped.
+    {
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        SliceCache.SetMaxCacheSize(1);
     }
 
-    // Get length of file.
-    ind fileLength;
-    file.seekg(0, std::ios::end);
-    fileLength = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    // Find out header size.
-    ind headerSize = 0;
-    if (fileLength != static_cast<ind>(dataSize * sizeof(double))) {
-        ind expectedNumber = dataSize * sizeof(double);
-        ind header = 0;
-        ind footer = 0;
-        headerSize = 0;
-        ind footerSize;
-        for (footerSize = 4; footerSize <= 8; footerSize += 4) {
-
-            file.seekg(fileLength - footerSize, std::ios::beg);
-            file.read((char*)&footer, footerSize);
-            if (footer == expectedNumber) {
-                headerSize = fileLength - (dataSize * sizeof(double) + footerSize);
-                if (headerSize > 0) {
-                    file.seekg(0, std::ios::beg);
-                    file.read((char*)&header, headerSize);
-
-                    if (header != static_cast<ind>(dataSize * sizeof(double))) continue;
-                }
-                break;
-            }
-            headerSize = 0;
-        }
+    if (timeSlice.get() != timeRange.getStart())
+        timeSlice.set(timeRange.getStart());
+    else
+        invalidate(InvalidationLevel::InvalidOutput);
+}
 
-        if (!headerSize) {
-            file.seekg(0, std::ios::beg);
-            file.read((char*)&header, headerSize);
+void RawPercolationLoader::stopTimeSlices() {
+    RunningTimeSlices = false;
+    runTimeSlices.setDisplayName("Run Time Slices");
 
-            if (header != static_cast<ind>(dataSize * sizeof(double))) {
-                std::cout << "Could not determine header size.\n";
-                std::cout << "\tHeader size: " << headerSize << " - " << header << std::endl;
-                std::cout << "\tFooter size: " << footerSize << " - " << footer << std::endl;
-                return nullptr;
-            }
+    std::lock_guard<std::mutex> Lock(SliceMutex);
+    SliceCache.SetMaxCacheSize(cacheSize.get());
+}
+
+ind RawPercolationLoader::SubVolume::sourceIndex(const size_t x, const size_t y,
+                                                const size_t z) const {
+    const size3_t Source = Offset + Stride * size3_t(x, y, z);
+    return Source.x + FileDims.x * (Source.y + FileDims.y * Source.z);
+}
+
+bool RawPercolationLoader::SubVolume::coversAxis(const int axis) const {
+    return Offset[axis] == 0 && Dims[axis] * Stride[axis] == FileDims[axis];
+}
+
+RawPercolationLoader::SubVolume RawPercolationLoader::getSubVolume() const {
+    SubVolume Region;
+    Region.FileDims = fieldSize.get();
+    Region.Offset = roiOffset.get();
+    Region.Stride = roiStride.get();
+    for (int axis = 0; axis < 3; ++axis) {
+        Region.Stride[axis] = std::max<size_t>(Region.Stride[axis], 1);
+        if (Region.Offset[axis] >= Region.FileDims[axis]) {
+            Region.Dims[axis] = 0;
+            continue;
         }
+        // An extent of 0 reaches to the end of the field.
+        size_t Extent = roiExtent.get()[axis];
+        const size_t Remaining = Region.FileDims[axis] - Region.Offset[axis];
+        if (Extent == 0 || Extent > Remaining) Extent = Remaining;
+        Region.Dims[axis] = (Extent + Region.Stride[axis] - 1) / Region.Stride[axis];
     }
+    return Region;
+}
 
-    // We read less, if so desired. This way, we can read a subvolume.
-    const ind BytesToBeRead = std::min((ind)fileLength, dataSize * (ind)sizeof(double));
-    if (BytesToBeRead > fileLength || BytesToBeRead < 1) return nullptr;
+std::array<bool, 3> RawPercolationLoader::getPeriodicity(const SubVolume& region) const {
+    // Wrapping around is only right if the region spans the whole axis, evenly spaced.
+    const bool Periodic[3] = {periodicX.get(), periodicY.get(), periodicZ.get()};
+    std::array<bool, 3> Result;
+    for (int axis = 0; axis < 3; ++axis) Result[axis] = Periodic[axis] && region.coversAxis(axis);
+    return Result;
+}
 
-    // Copy data into buffer
-    char* buffer = pData ? (char*)pData : new char[BytesToBeRead];
-    file.read(buffer, BytesToBeRead);
+std::string RawPercolationLoader::SliceSettings::staticKey() const {
+    std::ostringstream Key;
+    Key << Directory << '|' << Region.FileDims.x << ',' << Region.FileDims.y << ','
+        << Region.FileDims.z << '|' << ConstVolume << '|' << FullGrid;
+    return Key.str();
+}
 
-    // Check whether reading was successful
-    if (!file) {
-        if (!pData) delete[] buffer;
-        file.close();
-        return nullptr;
+std::string RawPercolationLoader::SliceSettings::sliceKey() const {
+    std::ostringstream Key;
+    Key << staticKey() << '|' << TimeSlice << '|' << SinglePrecision;
+    for (int axis = 0; axis < 3; ++axis)
+        Key << '|' << Region.Offset[axis] << ',' << Region.Stride[axis] << ','
+            << Region.Dims[axis] << ',' << Periodic[axis];
+    return Key.str();
+}
+
+RawPercolationLoader::SliceSettings RawPercolationLoader::getSliceSettings() const {
+    SliceSettings Settings;
+    Settings.Directory = folderName.get();
+    Settings.TimeSlice = timeSlice.get();
+    Settings.Region = getSubVolume();
+    Settings.Periodic = getPeriodicity(Settings.Region);
+    Settings.FullGrid = fullGrid.get();
+    Settings.ConstVolume = constVolume.get();
+    Settings.SinglePrecision = storagePrecision.get() == percolation::StoragePrecision::Float;
+    return Settings;
+}
+
+std::shared_ptr<const RawPercolationLoader::StaticFiles> RawPercolationLoader::getStaticFiles(
+    const SliceSettings& settings) const {
+    // Held while loading, so that concurrent slice loads map the files only once.
+    std::lock_guard<std::mutex> Lock(StaticMutex);
+    const std::string Key = settings.staticKey();
+    if (auto Cached = StaticCache.Find(Key)) return Cached;
+
+    const size3_t fileDims = settings.Region.FileDims;
+    const ind numFileElements = fileDims.x * fileDims.y * fileDims.z;
+    const ind numStatElements = fileDims.x * fileDims.y;
+
+    // One I/O thread per file, see loadViaVectorComponents.
+    // Only the first numRead values are read ahead, the rest is read on access, if ever.
+    auto Files = std::make_shared<StaticFiles>();
+    const std::string Axes[3] = {"x", "y", "z"};
+    std::vector<std::future<bool>> Loads;
+    auto loadAsync = [&Loads](percolation::RawComponentFile& file, const std::string& fileName,
+                              const ind numValues, const ind numRead) {
+        Loads.push_back(std::async(std::launch::async, [&file, fileName, numValues, numRead]() {
+            if (!file.Open(fileName, numValues)) return false;
+            file.Prefetch(0, numRead);
+            return true;
+        }));
+    };
+    for (int n = 0; n < 3; ++n) {
+        loadAsync(Files->Average[n], settings.Directory + "/STAT/average_v" + Axes[n],
+                  numStatElements, numStatElements);
+        // A rectilinear grid only takes the coordinates along each axis from the start of
+        // its file, see loadViaVectorComponents.
+        if (!settings.ConstVolume)
+            loadAsync(Files->Grid[n], settings.Directory + "/VELOCITY/" + Axes[n],
+                      numFileElements, settings.FullGrid ? numFileElements : fileDims[n]);
     }
-    file.close();
 
-    pData = reinterpret_cast<double*>(buffer);
+    bool loaded = true;
+    for (auto& Load : Loads) loaded &= Load.get();
+    if (!loaded) return nullptr;
 
-    return pData;
+    StaticCache.Add(Key, Files);
+    return Files;
 }
 
-namespace {
-template <int N>
-void interleaveData(std::shared_ptr<BufferChannel<double, N>> combined, double* data[N],
-                    ind numElementsEach) {
-    for (ind component = 0; component < N; ++component) {
-        for (ind element = 0; element < numElementsEach; ++element) {
-            combined->template get<typename std::array<double, N>>(element)[component] =
-                data[component][element];
+std::shared_ptr<DataSet> RawPercolationLoader::getSlice(const SliceSettings& settings) {
+    const std::string Key = settings.sliceKey();
+    {
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        if (auto Cached = SliceCache.Find(Key)) {
+            LogInfo("\tTaken from the cache.");
+            return Cached;
         }
     }
+
+    // The slice might be on its way already.
+    if (Prefetch.valid() && PrefetchKey == Key) {
+        Prefetch.get();
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        if (auto Cached = SliceCache.Find(Key)) {
+            LogInfo("\tTaken from the prefetch.");
+            return Cached;
+        }
+    }
+
+    auto Slice = loadSlice(settings);
+    if (Slice) {
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        SliceCache.Add(Key, Slice);
+    }
+    return Slice;
 }
 
-void explicitGridFromIntervals(double* intervals[3], size3_t dims,
-                               std::shared_ptr<BufferChannel<double, 3>> dataOut) {
+void RawPercolationLoader::prefetchSlice(const SliceSettings& settings) {
+    // At most one slice is read ahead, which bounds the memory.
+    if (Prefetch.valid()) {
+        if (Prefetch.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+        Prefetch.get();
+    }
+
+    const std::string Key = settings.sliceKey();
+    {
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        if (SliceCache.Find(Key)) return;
+    }
 
-    for (size_t z = 0; z < dims.z; ++z)
-        for (size_t y = 0; y < dims.y; ++y)
-            for (size_t x = 0; x < dims.x; ++x) {
-                ind lindex = x + dims.x * y + dims.x * dims.y * z;
-                auto data = dataOut->get<glm::vec<3, double>>(lindex);
-                data[0] = intervals[0][x];
-                data[1] = intervals[1][y];
-                data[2] = intervals[2][z];
-            }
+    PrefetchKey = Key;
+    Prefetch = std::async(std::launch::async, [this, settings, Key]() {
+        auto Slice = loadSlice(settings);
+        if (!Slice) return;
+        std::lock_guard<std::mutex> Lock(SliceMutex);
+        SliceCache.Add(Key, Slice);
+    });
+}
+
+std::shared_ptr<DataSet> RawPercolationLoader::loadSlice(const SliceSettings& settings) const {
+    auto Slice = loadViaVectorComponents(settings);
+    if (Slice) addVolume(*Slice, settings);
+    return Slice;
 }
-}  // namespace
 
-DataSet* RawPercolationLoader::loadViaVectorComponents() {
+std::shared_ptr<DataSet> RawPercolationLoader::loadViaVectorComponents(
+    const SliceSettings& settings) const {
     // Load file
-    const std::string& Directory = folderName.get();
+    const std::string& Directory = settings.Directory;
     if (!filesystem::directoryExists(Directory)) return nullptr;
 
     PerformanceTimer Timer;
 
-    auto dims = fieldSize.get();
+    const SubVolume& Region = settings.Region;
+    const size3_t fileDims = Region.FileDims;
+    const ind numFileElements = fileDims.x * fileDims.y * fileDims.z;
+    const ind numStatElements = fileDims.x * fileDims.y;
+
+    const size3_t dims = Region.Dims;
     const ind numElements = dims.x * dims.y * dims.z;
-    const ind numStatElements = dims.x * dims.y;
+    if (numElements == 0) {
+        LogWarn("The region of interest is empty.");
+        return nullptr;
+    }
 
-    ind numZeros = 4 - (ind)std::log10(timeSlice.get());
+    ind numZeros = 4 - (ind)std::log10(settings.TimeSlice);
     std::string zeros = std::string(numZeros, '0');
     zeros = zeros;
 
-    ind headerSize = noHeader.get() ? 8 : 4;
-    double* dataBuffer[3] = {
-        loadComponent(Directory + "/VELOCITY/" + zeros + std::to_string(timeSlice.get()) + ".vx",
-                      dims, 4),
-        loadComponent(Directory + "/VELOCITY/" + zeros + std::to_string(timeSlice.get()) + ".vy",
-                      dims, 4),
-        loadComponent(Directory + "/VELOCITY/" + zeros + std::to_string(timeSlice.get()) + ".vz",
-                      dims, 4)};
-
-    double* gridBuffer[3] = {nullptr, nullptr, nullptr};
-    if (!constVolume.get()) {
-        gridBuffer[0] = loadComponent(Directory + "/VELOCITY/x", dims, headerSize);
-        gridBuffer[1] = loadComponent(Directory + "/VELOCITY/y", dims, headerSize);
-        gridBuffer[2] = loadComponent(Directory + "/VELOCITY/z", dims, headerSize);
-    }
-
-    double* avgBuffer[3] = {loadComponent(Directory + "/STAT/average_vx", dims, 4, nullptr, true),
-                            loadComponent(Directory + "/STAT/average_vy", dims, 4, nullptr, true),
-                            loadComponent(Directory + "/STAT/average_vz", dims, 4, nullptr, true)};
-
-    if (!dataBuffer[0] || !dataBuffer[1] || !dataBuffer[2] || !avgBuffer[0] || !avgBuffer[1] ||
-        !avgBuffer[2] ||
-        (!constVolume.get() && (!gridBuffer[0] || !gridBuffer[1] || !gridBuffer[2]))) {
+    // All components are mapped and opened concurrently, one I/O thread per file: the parallel
+    // file system serves several outstanding requests much faster. The averages and the grid
+    // are read completely and cached across slices. The velocity is streamed in z-slabs below,
+    // straight from the mappings.
+    const std::string VelocityName =
+        Directory + "/VELOCITY/" + zeros + std::to_string(settings.TimeSlice);
+    const std::string Axes[3] = {"x", "y", "z"};
+    percolation::RawComponentFile dataBuffer[3];
+    std::vector<std::future<bool>> Loads;
+    for (int n = 0; n < 3; ++n)
+        Loads.push_back(std::async(std::launch::async, [&dataBuffer, n, &VelocityName, &Axes,
+                                                        numFileElements]() {
+            return dataBuffer[n].Open(VelocityName + ".v" + Axes[n], numFileElements);
+        }));
+
+    const auto Static = getStaticFiles(settings);
+    bool loaded = Static != nullptr;
+    for (auto& Load : Loads) loaded &= Load.get();
+
+    if (!loaded) {
         LogInfo("Could not load all needed files.");
-        for (int i = 0; i < 3; ++i) {
-            delete[] dataBuffer[i];
-            delete[] gridBuffer[i];
-            delete[] avgBuffer[i];
-        }
         return nullptr;
     }
+    const auto& avgBuffer = Static->Average;
+    const auto& gridBuffer = Static->Grid;
 
-    LogInfo("Raw data loading took " << Timer.ElapsedTime() << " seconds.");
+    // Recorded with the channels, a cache file of derived data is outdated once these change.
+    std::vector<std::string> VelocitySources, AverageSources, GridSources;
+    for (int n = 0; n < 3; ++n) {
+        VelocitySources.push_back(VelocityName + ".v" + Axes[n]);
+        AverageSources.push_back(Directory + "/STAT/average_v" + Axes[n]);
+        GridSources.push_back(Directory + "/VELOCITY/" + Axes[n]);
+    }
+
+    LogInfo("Opening the raw data took " << Timer.ElapsedTime() << " seconds.");
 
     Timer.Reset();
 
-    DataSet* dataSet = new DataSet(std::make_shared<PeriodicGrid<3>>(
-        std::array<ind, 3>({(ind)dims.x, (ind)dims.y, (ind)dims.z}),
-        std::array<bool, 3>({periodicX.get(), periodicY.get(), periodicZ.get()})));
+    auto dataSet = std::make_shared<DataSet>(std::make_shared<PeriodicGrid<3>>(
+        std::array<ind, 3>({(ind)dims.x, (ind)dims.y, (ind)dims.z}), settings.Periodic));
 
-    if (!constVolume.get()) {
+    if (!settings.ConstVolume && settings.FullGrid) {
         // Create grid buffer
         auto grid = std::make_shared<BufferChannel<double, 3>>(numElements, "Vertex Positions",
                                                                GridPrimitive::Vertex);
+        percolation::addSourceFiles(*grid, GridSources);
         dataSet->addChannel(grid);
-        if (!constVolume.get()) {
-            if (fullGrid.get())
-                interleaveData<3>(grid, gridBuffer, numElements);
-            else
-                explicitGridFromIntervals(gridBuffer, dims, grid);
-        }
-    }
-
-    // Compute percolation analysis scalar value
-    auto AvgPercolationData = std::make_shared<BufferChannel<double, 3>>(
-        numElements, "AveragedVelocity", GridPrimitive::Vertex);
-    auto PercolationData =
-        std::make_shared<BufferChannel<double, 3>>(numElements, "Velocity", GridPrimitive::Vertex);
 
-    for (int n = 0; n < 3; ++n) {
 #pragma omp parallel for
         for (ind linearIdx = 0; linearIdx < numElements; ++linearIdx) {
-            // Raw data pointer to write to.
-            auto& pData =
-                (PercolationData->template get<typename std::array<double, 3>>(linearIdx));
+            const size_t x = linearIdx % dims.x;
+            const size_t y = (linearIdx / dims.x) % dims.y;
+            const size_t z = linearIdx / (dims.x * dims.y);
+            auto& pos = grid->template get<typename std::array<double, 3>>(linearIdx);
 
-            pData[n] = dataBuffer[n][linearIdx];
+            const ind Source = Region.sourceIndex(x, y, z);
+            for (int n = 0; n < 3; ++n) pos[n] = gridBuffer[n][Source];
+        }
+    } else if (!settings.ConstVolume) {
+        // Rectilinear grid: keep one coordinate per vertex along each axis and evaluate
+        // the positions on access. Only the first entries of the interval files are used.
+        std::array<std::vector<double>, 3> Coords;
+        for (int n = 0; n < 3; ++n) {
+            Coords[n].resize(dims[n]);
+            for (size_t i = 0; i < dims[n]; ++i)
+                Coords[n][i] = gridBuffer[n][Region.Offset[n] + Region.Stride[n] * i];
         }
+
+        auto grid = std::make_shared<AnalyticChannel<double, 3, std::array<double, 3>>>(
+            [Coords, dims](std::array<double, 3>& pos, ind idx) {
+                pos[0] = Coords[0][idx % dims.x];
+                pos[1] = Coords[1][(idx / dims.x) % dims.y];
+                pos[2] = Coords[2][idx / (dims.x * dims.y)];
+            },
+            numElements, "Vertex Positions", GridPrimitive::Vertex);
+        percolation::addSourceFiles(*grid, GridSources);
+        dataSet->addChannel(grid);
+    }
+
+    // Compute percolation analysis scalar value
+    // Both channels are stored in the chosen precision, converted once while streaming.
+    std::shared_ptr<BufferChannel<double, 3>> PercolationData, AvgPercolationData;
+    std::shared_ptr<BufferChannel<float, 3>> PercolationDataFloat, AvgPercolationDataFloat;
+    if (settings.SinglePrecision) {
+        AvgPercolationDataFloat = std::make_shared<BufferChannel<float, 3>>(
+            numElements, "AveragedVelocity", GridPrimitive::Vertex);
+        PercolationDataFloat = std::make_shared<BufferChannel<float, 3>>(numElements, "Velocity",
+                                                                         GridPrimitive::Vertex);
+    } else {
+        AvgPercolationData = std::make_shared<BufferChannel<double, 3>>(
+            numElements, "AveragedVelocity", GridPrimitive::Vertex);
+        PercolationData = std::make_shared<BufferChannel<double, 3>>(numElements, "Velocity",
+                                                                     GridPrimitive::Vertex);
     }
 
+    // Calls rowRange(begin, count) on the file values of the x-rows needed for the given
+    // output z-planes. Contiguous rows are merged, a full field gives one range per slab.
+    const size_t RowLength = (dims.x - 1) * Region.Stride.x + 1;
+    auto forSlabRows = [&Region, &dims, RowLength](const size_t zBegin, const size_t zEnd,
+                                                   const auto& rowRange) {
+        ind RangeBegin = 0, RangeCount = 0;
+        for (size_t z = zBegin; z < zEnd; ++z)
+            for (size_t y = 0; y < dims.y; ++y) {
+                const ind RowBegin = Region.sourceIndex(0, y, z);
+                if (RangeCount > 0 && RangeBegin + RangeCount == RowBegin) {
+                    RangeCount += RowLength;
+                    continue;
+                }
+                if (RangeCount > 0) rowRange(RangeBegin, RangeCount);
+                RangeBegin = RowBegin;
+                RangeCount = RowLength;
+            }
+        if (RangeCount > 0) rowRange(RangeBegin, RangeCount);
+    };
+
+    // Stream the velocity in z-slabs: while one slab is converted, the next one is read.
+    // Each vertex is written to both channels at once, and converted slabs are dropped again.
+    // Thus, only the output channels are held in full.
+    const size_t SlabPlanes =
+        std::max<size_t>(1, SlabBytes / (dims.y * RowLength * sizeof(double)));
+    auto readSlab = [&dataBuffer, &forSlabRows, &dims](const size_t zBegin, const size_t zEnd) {
+        std::vector<std::future<void>> Reads;
+        if (zBegin >= dims.z) return Reads;
+        for (int n = 0; n < 3; ++n)
+            Reads.push_back(
+                std::async(std::launch::async, [&dataBuffer, &forSlabRows, n, zBegin, zEnd]() {
+                    forSlabRows(zBegin, zEnd, [&dataBuffer, n](const ind begin, const ind count) {
+                        dataBuffer[n].Prefetch(begin, count);
+                    });
+                }));
+        return Reads;
+    };
+
+    // Converts the output z-planes [zBegin, zEnd) row by row. Along a row, the source values
+    // are evenly strided, so the inner loop vectorizes, including the conversion to float.
+    auto convertSlab = [&](auto& velocityOut, auto& fluctuationOut, const size_t zBegin,
+                           const size_t zEnd) {
+        using T = typename std::decay_t<decltype(velocityOut.data())>::value_type;
+        const ind rowBegin = zBegin * dims.y;
+        const ind rowEnd = zEnd * dims.y;
+
 #pragma omp parallel for
-    for (ind linearIdx = 0; linearIdx < numElements; ++linearIdx) {
-        // Raw data pointer to write to.
-        auto& pData = (AvgPercolationData->template get<typename std::array<double, 3>>(linearIdx));
+        for (ind row = rowBegin; row < rowEnd; ++row) {
+            const ind RowSource = Region.sourceIndex(0, row % dims.y, row / dims.y);
+            const ind RowPlane = RowSource % numStatElements;
 
-        for (int n = 0; n < 3; ++n) {
-            // Compute the percolation analysis scalar value
-            double component =
-                (dataBuffer[n][linearIdx] -
-                 avgBuffer[n][linearIdx %
-                              numStatElements]);  // / rmsBuffer[n][linearIdx % numStatElements];
-            component = abs(component);
-            pData[n] = std::isfinite(component) ? component : 0;
+            for (size_t x = 0; x < dims.x; ++x) {
+                const ind Source = RowSource + x * Region.Stride.x;
+                const ind Plane = RowPlane + x * Region.Stride.x;
+
+                // Raw data pointers to write to.
+                auto& pData = velocityOut.template get<std::array<T, 3>>(row * dims.x + x);
+                auto& pAvgData = fluctuationOut.template get<std::array<T, 3>>(row * dims.x + x);
+
+                for (int n = 0; n < 3; ++n) {
+                    const double Velocity = dataBuffer[n][Source];
+                    pData[n] = static_cast<T>(Velocity);
+
+                    // Compute the percolation analysis scalar value
+                    // / rmsBuffer[n][Plane];
+                    double component = (Velocity - avgBuffer[n][Plane]);
+                    component = std::abs(component);
+                    pAvgData[n] = std::isfinite(component) ? static_cast<T>(component) : T(0);
+                }
+            }
         }
+    };
+
+    auto SlabReads = readSlab(0, std::min(dims.z, SlabPlanes));
+    for (size_t zBegin = 0; zBegin < dims.z; zBegin += SlabPlanes) {
+        const size_t zEnd = std::min(dims.z, zBegin + SlabPlanes);
+        for (auto& Read : SlabReads) Read.get();
+        SlabReads = readSlab(zEnd, std::min(dims.z, zEnd + SlabPlanes));
+
+        if (settings.SinglePrecision)
+            convertSlab(*PercolationDataFloat, *AvgPercolationDataFloat, zBegin, zEnd);
+        else
+            convertSlab(*PercolationData, *AvgPercolationData, zBegin, zEnd);
+
+        forSlabRows(zBegin, zEnd, [&dataBuffer](const ind begin, const ind count) {
+            for (int n = 0; n < 3; ++n) dataBuffer[n].Release(begin, count);
+        });
+    }
+    // Tells the analysis which slice its rows belong to.
+    if (settings.SinglePrecision)
+        percolation::setTimeSlice(*PercolationDataFloat, settings.TimeSlice);
+    else
+        percolation::setTimeSlice(*PercolationData, settings.TimeSlice);
+
+    LogInfo("\t\tGrid creation and streamed normalization took " << Timer.ElapsedTime()
+                                                                  << " seconds.");
+
+    if (settings.SinglePrecision) {
+        percolation::addSourceFiles(*PercolationDataFloat, VelocitySources);
+        percolation::addSourceFiles(*AvgPercolationDataFloat, AverageSources);
+        dataSet->addChannel(PercolationDataFloat);
+        dataSet->addChannel(AvgPercolationDataFloat);
+    } else {
+        percolation::addSourceFiles(*PercolationData, VelocitySources);
+        percolation::addSourceFiles(*AvgPercolationData, AverageSources);
+        dataSet->addChannel(PercolationData);
+        dataSet->addChannel(AvgPercolationData);
     }
-    LogInfo("\t\tGrid creation and normalization took " << Timer.ElapsedTime() << " seconds.");
 
-    // Get rid of some memory
-    for (int i = 0; i < 3; ++i) {
-        delete[] dataBuffer[i];
-        delete[] gridBuffer[i];
-        delete[] avgBuffer[i];
+    // Statistics files, e.g., the RMS, cover the xy-planes of the whole field.
+    // For a region of interest, tell their users where each vertex comes from.
+    if (dims.x != fileDims.x || dims.y != fileDims.y) {
+        dataSet->addChannel(std::make_shared<AnalyticChannel<int, 1, int>>(
+            [Region, dims](int& val, ind idx) {
+                val = static_cast<int>(
+                    Region.sourceIndex(idx % dims.x, (idx / dims.x) % dims.y, 0) %
+                    (Region.FileDims.x * Region.FileDims.y));
+            },
+            numElements, "Source Plane Index", GridPrimitive::Vertex));
     }
-    dataSet->addChannel(PercolationData);
-    dataSet->addChannel(AvgPercolationData);
 
     return dataSet;
 }
 
 void RawPercolationLoader::process() {
-    if (data_ && !folderName.isModified() && !timeSlice.isModified() && !fieldSize.isModified() &&
-        !noHeader.isModified()) {
-        IVW_ASSERT(periodicX.isModified() || periodicY.isModified() || periodicZ.isModified(),
-                   "Unexpected process() call without any changed property.");
-
-        auto* perGrid = dynamic_cast<const PeriodicGrid<3>*>(data_->getGrid().get());
-        IVW_ASSERT(perGrid != nullptr, "Assumed periodic grid.");
-
-        auto newGrid = std::make_shared<PeriodicGrid<3>>(*perGrid);
-        newGrid->setPeriodic(0, periodicX.get());
-        newGrid->setPeriodic(1, periodicY.get());
-        newGrid->setPeriodic(2, periodicZ.get());
-
-        // Copy grid and data.
-        auto newData = std::make_shared<DataSet>(newGrid);
-        for (auto it = data_->cbegin(); it != data_->cend(); ++it) newData->addChannel(it->second);
+    const SliceSettings Settings = getSliceSettings();
+
+    // Only the periodicity changed: Keep the channels, exchange the grid and the volume.
+    // Cached like a loaded slice, its key includes the periodicity.
+    // Without any change, e.g., when a time slice run starts, the slice is passed on again.
+    const bool PeriodicityChanged =
+        periodicX.isModified() || periodicY.isModified() || periodicZ.isModified();
+    if (data_ && PeriodicityChanged && !folderName.isModified() && !timeSlice.isModified() &&
+        !fieldSize.isModified() && !roiOffset.isModified() && !roiExtent.isModified() &&
+        !roiStride.isModified() && !fullGrid.isModified() && !constVolume.isModified() &&
+        !storagePrecision.isModified()) {
+        const std::string Key = Settings.sliceKey();
+        std::shared_ptr<DataSet> Slice;
+        {
+            std::lock_guard<std::mutex> Lock(SliceMutex);
+            Slice = SliceCache.Find(Key);
+        }
+        if (!Slice) {
+            Slice = withPeriodicity(*data_, Settings);
+            std::lock_guard<std::mutex> Lock(SliceMutex);
+            SliceCache.Add(Key, Slice);
+        }
 
-        data_ = newData;
+        data_ = Slice;
         portOutData.setData(data_);
-
         return;
     }
     LogInfo("=== Loading t=" << timeSlice.get() << " at " << fieldSize.get()[0] << ", "
                              << fieldSize.get()[1] << ", " << fieldSize.get()[2] << ":\n");
 
     PerformanceTimer Timer;
-    data_ = std::shared_ptr<DataSet>(loadViaVectorComponents());
+    data_ = getSlice(Settings);
     if (!data_) {
         LogWarn("Loading failed.");
+        if (RunningTimeSlices) stopTimeSlices();
         return;
     }
     LogInfo("\tFile loading took " << Timer.ElapsedTime() << " seconds.");
 
+    portOutData.setData(data_);
+
+    // Read the next slice while this one is being analysed.
+    const int LastSlice = RunningTimeSlices ? timeRange.getEnd() : timeSlice.getMaxValue();
+    if ((prefetchNext.get() || RunningTimeSlices) && Settings.TimeSlice < LastSlice) {
+        SliceSettings Next = Settings;
+        Next.TimeSlice++;
+        prefetchSlice(Next);
+    }
+
+    if (!RunningTimeSlices) return;
+    if (Settings.TimeSlice >= LastSlice) {
+        LogInfo("Ran all time slices up to t=" << LastSlice << ".");
+        stopTimeSlices();
+        return;
+    }
+
+    // Dispatched to run after this network evaluation, i.e., after the downstream
+    // processors are done with this slice.
+    std::weak_ptr<int> Alive = Lifetime;
+    const int NextSlice = Settings.TimeSlice + 1;
+    dispatchFront([this, Alive, NextSlice]() {
+        if (Alive.expired() || !RunningTimeSlices) return;
+        timeSlice.set(NextSlice);
+    });
+}
+
+std::shared_ptr<DataSet> RawPercolationLoader::withPeriodicity(const DataSet& slice,
+                                                               const SliceSettings& settings) {
+    auto* perGrid = dynamic_cast<const PeriodicGrid<3>*>(slice.getGrid().get());
+    IVW_ASSERT(perGrid != nullptr, "Assumed periodic grid.");
+
+    auto newGrid = std::make_shared<PeriodicGrid<3>>(*perGrid);
+    for (int axis = 0; axis < 3; ++axis) newGrid->setPeriodic(axis, settings.Periodic[axis]);
+
+    // Copy the data. The volume depends on the periodicity, through the dual cells at the boundary.
+    auto newData = std::make_shared<DataSet>(newGrid);
+    for (auto it = slice.cbegin(); it != slice.cend(); ++it) {
+        if (it->second->getName() != "Volume") newData->addChannel(it->second);
+    }
+    addVolume(*newData, settings);
+    return newData;
+}
+
+void RawPercolationLoader::addVolume(DataSet& dataSet, const SliceSettings& settings) {
+    // Rectilinear grids: each vertex volume is the sum of an eighth of its adjacent cells.
+    // That is the product of the dual cell widths along the axes, so O(nx + ny + nz) memory.
+    if (!settings.ConstVolume) {
+        const size3_t dims = settings.Region.Dims;
+        auto Positions =
+            dataSet.getChannel<double, 3>("Vertex Positions", GridPrimitive::Vertex);
+        std::array<std::vector<double>, 3> Axes;
+        if (Positions && percolation::rectilinearAxes(*Positions, dims, settings.FullGrid, Axes)) {
+            std::array<std::vector<double>, 3> Widths;
+            for (int axis = 0; axis < 3; ++axis)
+                Widths[axis] = percolation::dualWidths(Axes[axis], settings.Periodic[axis]);
+
+            auto VolumeDataVert = std::make_shared<AnalyticChannel<double, 1, double>>(
+                [Widths, dims](double& val, ind idx) {
+                    val = Widths[0][idx % dims.x] * Widths[1][(idx / dims.x) % dims.y] *
+                          Widths[2][idx / (dims.x * dims.y)];
+                },
+                dataSet.getGrid()->getNumElements(GridPrimitive::Vertex), "Volume",
+                GridPrimitive::Vertex);
+            dataSet.addChannel(VolumeDataVert);
+            return;
+        }
+    }
+
     // Compute volume per voxel
-    if (!constVolume.get()) {
+    if (!settings.ConstVolume) {
         auto VolumeData = std::make_shared<BufferChannel<double, 1>>(
-            data_->getGrid()->getNumElements(GridPrimitive::Volume), "Volume",
+            dataSet.getGrid()->getNumElements(GridPrimitive::Volume), "Volume",
             GridPrimitive::Volume);
         double TotalVolume(0);
 
-        auto Positions = data_->getChannel("Vertex Positions");
+        auto Positions = dataSet.getChannel("Vertex Positions");
 
-        for (auto element : data_->getGrid()->all(GridPrimitive::Volume)) {
+        for (auto element : dataSet.getGrid()->all(GridPrimitive::Volume)) {
             const double ThisVolume = euclidean::getMeasure(*Positions, element);
             VolumeData->get(element.getIndex()) = ThisVolume;
             TotalVolume += ThisVolume;
@@ -335,13 +664,13 @@ void RawPercolationLoader::process() {
         // Map volume from cell to vertices
         std::vector<ind> CellNeighs;
         auto VolumeDataVert = std::make_shared<BufferChannel<double>>(
-            data_->getGrid()->getNumElements(GridPrimitive::Vertex), "Volume",
+            dataSet.getGrid()->getNumElements(GridPrimitive::Vertex), "Volume",
             GridPrimitive::Vertex);
         TotalVolume = 0;
-        for (const auto& Vertex : data_->getGrid()->all(GridPrimitive::Vertex)) {
+        for (const auto& Vertex : dataSet.getGrid()->all(GridPrimitive::Vertex)) {
             // For all cells neighboring the vertex
-            data_->getGrid()->getConnections(CellNeighs, Vertex.getIndex(), GridPrimitive::Vertex,
-                                             GridPrimitive::Volume);
+            dataSet.getGrid()->getConnections(CellNeighs, Vertex.getIndex(),
+                                              GridPrimitive::Vertex, GridPrimitive::Volume);
 
             // Each vertex gets an eigth of each neighboring cube
             double VertexVolume(0);
@@ -353,17 +682,15 @@ void RawPercolationLoader::process() {
             VolumeDataVert->get(Vertex.getIndex()) = VertexVolume;
             TotalVolume += VertexVolume;
         }
-        data_->addChannel(VolumeDataVert);
+        dataSet.addChannel(VolumeDataVert);
     } else {
         // Constant channel.
         auto VolumeDataVert = std::make_shared<AnalyticChannel<double, 1, double>>(
             [](double& val, ind) { val = 1.0; },
-            data_->getGrid()->getNumElements(GridPrimitive::Vertex), "Volume",
+            dataSet.getGrid()->getNumElements(GridPrimitive::Vertex), "Volume",
             GridPrimitive::Vertex);
-        data_->addChannel(VolumeDataVert);
+        dataSet.addChannel(VolumeDataVert);
     }
-
-    portOutData.setData(data_);
 }
 
 }  // namespace inviwo
@@ -17,10 +17,23 @@
 #include <inviwo/core/properties/ordinalproperty.h>
 #include <inviwo/core/properties/fileproperty.h>
 #include <inviwo/core/properties/boolproperty.h>
+#include <inviwo/core/properties/buttonproperty.h>
+#include <inviwo/core/properties/minmaxproperty.h>
+#include <inviwo/core/properties/optionproperty.h>
+#include <modules/kxtools/simplelrucache.h>
+#include <percolation/util/rawcomponentfile.h>
+
+#include <future>
+#include <mutex>
 
 namespace inviwo {
 using namespace discretedata;
 
+namespace percolation {
+/// Value type of the loaded velocity channels
+enum class StoragePrecision { Double, Float };
+}  // namespace percolation
+
 /** \class RawPercolationLoader
     \brief Load a dataset generated from Nek5000.
     Manually insert folder and 3D sizes.
@@ -34,7 +47,7 @@ public:
     // Construction / Deconstruction
 public:
     RawPercolationLoader();
-    virtual ~RawPercolationLoader() = default;
+    virtual ~RawPercolationLoader();
 
     // Methods
 public:
@@ -45,11 +58,64 @@ protected:
     /// Our main computation function
     virtual void process() override;
 
-    DataSet* loadViaVectorComponents();
+    /// Part of the files that is loaded: Dims vertices per axis, every Stride-th from Offset on.
+    struct SubVolume {
+        size3_t FileDims, Offset, Stride, Dims;
 
-public:
-    static double* loadComponent(const std::string& filename, const ivec3 expectedFileSize,
-                                 const ind header = 4, double* pData = nullptr, bool is2D = false);
+        /// Linear index in the files of a loaded vertex
+        ind sourceIndex(const size_t x, const size_t y, const size_t z) const;
+
+        /// Whether the loaded vertices span the axis evenly, so that it may wrap around
+        bool coversAxis(const int axis) const;
+    };
+    SubVolume getSubVolume() const;
+
+    /// Periodicity of the loaded grid. Axes that are cut or unevenly strided do not wrap.
+    std::array<bool, 3> getPeriodicity(const SubVolume& region) const;
+
+    /// Everything that determines a loaded time slice. Slices are loaded from a copy,
+    /// so that the next one can be read in the background while properties change.
+    struct SliceSettings {
+        std::string Directory;
+        int TimeSlice;
+        SubVolume Region;
+        std::array<bool, 3> Periodic;
+        bool FullGrid, ConstVolume, SinglePrecision;
+
+        /// Identifies the slice in the cache
+        std::string sliceKey() const;
+
+        /// Identifies the files shared by all slices
+        std::string staticKey() const;
+    };
+    SliceSettings getSliceSettings() const;
+
+    /// Files that are the same for all time slices, kept mapped and read
+    struct StaticFiles {
+        percolation::RawComponentFile Average[3], Grid[3];
+    };
+    std::shared_ptr<const StaticFiles> getStaticFiles(const SliceSettings& settings) const;
+
+    /// Returns the slice from the cache, or loads and caches it.
+    std::shared_ptr<DataSet> getSlice(const SliceSettings& settings);
+
+    /// Starts loading a slice in the background, unless it is cached or another one is on its way.
+    void prefetchSlice(const SliceSettings& settings);
+
+    /// Velocity, fluctuation, positions and volume of a slice. Safe to call from any thread.
+    std::shared_ptr<DataSet> loadSlice(const SliceSettings& settings) const;
+    std::shared_ptr<DataSet> loadViaVectorComponents(const SliceSettings& settings) const;
+    static void addVolume(DataSet& dataSet, const SliceSettings& settings);
+    /// Same channels on a grid with the periodicity of the settings, the volume is recomputed
+    static std::shared_ptr<DataSet> withPeriodicity(const DataSet& slice,
+                                                    const SliceSettings& settings);
+
+    /// Steps through the time slice range, one slice per network evaluation
+    void startTimeSlices();
+    void stopTimeSlices();
+
+    /// Bytes per component that are read and converted at once
+    static constexpr ind SlabBytes = ind(64) << 20;
 
     // Ports
 public:
@@ -64,11 +130,48 @@ public:
 
     /// Field size
     IntSize3Property fieldSize;
-    BoolProperty periodicX, periodicY, periodicZ, noHeader, fullGrid, constVolume;
+
+    /// Region of interest in vertices, an extent of 0 reaches to the end of the field
+    IntSize3Property roiOffset, roiExtent;
+    /// Load only every n-th vertex per axis
+    IntSize3Property roiStride;
+    BoolProperty periodicX, periodicY, periodicZ, fullGrid, constVolume;
+
+    /// Velocity channels in float halve the memory of this and all later stages
+    TemplateOptionProperty<percolation::StoragePrecision> storagePrecision;
+
+    /// Number of loaded time slices kept in memory
+    IntProperty cacheSize;
+    /// Load slice t+1 in the background after slice t
+    BoolProperty prefetchNext;
+
+    /// Slices to step through. Each one is passed on after the previous one has been processed
+    /// downstream, while the next one is read. Only these two slices are kept in memory.
+    /// A PercolationAnalysis appends the rows of consecutive slices to one table.
+    IntMinMaxProperty timeRange;
+    ButtonProperty runTimeSlices;
 
     // Attributes
 private:
     std::shared_ptr<DataSet> data_;
+
+    /// Loaded slices, filled by process() and the background prefetch
+    KxSimpleLRUCache<std::string, DataSet> SliceCache;
+    std::mutex SliceMutex;
+
+    /// Averages and grid, shared by all slices
+    mutable KxSimpleLRUCache<std::string, const StaticFiles> StaticCache;
+    mutable std::mutex StaticMutex;
+
+    /// Slice being loaded in the background
+    std::future<void> Prefetch;
+    std::string PrefetchKey;
+
+    /// Whether we are stepping through timeRange
+    bool RunningTimeSlices = false;
+
+    /// Expires with the processor, guards callbacks dispatched to the main thread.
+    std::shared_ptr<int> Lifetime;
 };
 
 }  // namespace
@@ -9,7 +9,8 @@
  */
 
 #include <percolation/processors/scalartransform.h>
-#include <percolation/processors/rawpercolationloader.h>
+#include <percolation/util/channelmetadata.h>
+#include <percolation/util/rawcomponentfile.h>
 #include <modules/discretedata/dataset.h>
 #include <modules/discretedata/connectivity/structuredgrid.h>
 #include <modules/discretedata/connectivity/elementiterator.h>
@@ -70,6 +71,46 @@ ScalarTransform::ScalarTransform()
     rmsName.onChange([this]() { this->OnChangeRMS(); });
 }
 
+namespace {
+/// Transforms the velocity into a scalar divided by the RMS, in the precision of the velocity.
+/// planeIndex(vertex) gives the index into the xy-planar RMS values.
+template <typename T, typename TPlaneIndex>
+std::shared_ptr<BufferChannel<T, 1>> transformVelocity(const BufferChannel<T, 3>& velocity,
+                                                       const BufferChannel<T, 3>& avgVelocity,
+                                                       ScalarTransform::ScalarFunc scalarFunc,
+                                                       const percolation::RawComponentFile& rms,
+                                                       const TPlaneIndex& planeIndex,
+                                                       const T undefinedValue) {
+    const ind NumVertices = velocity.size();
+    auto percolationScalar = std::make_shared<BufferChannel<T, 1>>(
+        NumVertices, "PercolationScalar", GridPrimitive::Vertex);
+
+#pragma omp parallel for
+    for (ind xyz = 0; xyz < NumVertices; ++xyz) {
+        // Load RMS value/mask.
+        const double rmsValue = rms[planeIndex(xyz)];
+        IVW_ASSERT(rmsValue >= 0, "RMS not positive: " << rmsValue);
+
+        // Check if valid.
+        if (rmsValue == 0) {
+            percolationScalar->get(xyz) = undefinedValue;
+            continue;
+        }
+
+        // Divide by RMS. The scalar is computed in double, whatever the storage.
+        const auto& velocityXYZ = velocity.template get<std::array<T, 3>>(xyz);
+        const auto& AvgVelocityXYZ = avgVelocity.template get<std::array<T, 3>>(xyz);
+        const std::array<double, 3> Raw = {velocityXYZ[0], velocityXYZ[1], velocityXYZ[2]};
+        const std::array<double, 3> Avg = {AvgVelocityXYZ[0], AvgVelocityXYZ[1],
+                                           AvgVelocityXYZ[2]};
+        const double scalar = std::abs(scalarFunc(Avg, Raw));
+        percolationScalar->get(xyz) = static_cast<T>(scalar / rmsValue);
+    }
+
+    return percolationScalar;
+}
+}  // namespace
+
 void ScalarTransform::process() {
     // Get data
     auto inData = portInData.getData();
@@ -77,8 +118,6 @@ void ScalarTransform::process() {
 
     // New output dataset.
     auto outData = std::make_shared<DataSet>(*inData.get());
-    auto velocity = inData->getAsBuffer<double, 3>("Velocity", GridPrimitive::Vertex);
-    auto avgVelocity = inData->getAsBuffer<double, 3>("AveragedVelocity", GridPrimitive::Vertex);
 
     // Could not match file name to known scalar variant.
     if (!_currentScalar.second) {
@@ -86,9 +125,6 @@ void ScalarTransform::process() {
         return;
     }
 
-    // Transform velocity into selected scalar.
-    BufferChannel<double, 1>* percolationScalar =
-        new BufferChannel<double, 1>(velocity->size(), "PercolationScalar", GridPrimitive::Vertex);
     auto regGrid = dynamic_cast<const StructuredGrid<3>*>(inData->getGrid().get());
     if (!regGrid) {
         LogWarn("Not a regular grid as expected. Aborting.");
@@ -101,42 +137,81 @@ void ScalarTransform::process() {
         return;
     }
 
-    // Load rms.
-    ivec3 numVertsVec(regGrid->getNumVerticesInDimension(0), regGrid->getNumVerticesInDimension(1),
-                      1);
-    ind numVertsXY = (numVertsVec.x * numVertsVec.y);
-    double* rmsBuffer =
-        RawPercolationLoader::loadComponent(rmsName.get(), numVertsVec, 0, nullptr, true);
-
-    if (!rmsBuffer) {
+    // Load rms. A region of interest tells which plane of the full field each vertex is in,
+    // otherwise the planes of the grid and the file coincide.
+    ind numVertsXY =
+        regGrid->getNumVerticesInDimension(0) * regGrid->getNumVerticesInDimension(1);
+    auto sourcePlane = inData->getChannel<int, 1>("Source Plane Index", GridPrimitive::Vertex);
+    percolation::RawComponentFile rms;
+    if (!rms.Open(rmsName.get(), sourcePlane ? 0 : numVertsXY)) {
         LogWarn("Could not load given file. Aborting.");
         return;
     }
 
-    // Data okay. Start iterating.
-    for (ind z = 0; z <= regGrid->getNumVerticesInDimension(2) - 1; ++z)
-        for (ind xy = 0; xy < numVertsXY; ++xy) {
-            ind xyz = xy + z * numVertsXY;
-
-            // Load RMS value/mask.
-            double rms = rmsBuffer[xy];
-            IVW_ASSERT(rms >= 0, "RMS not positive: " << rms);
-
-            // Check if valid.
-            if (rms == 0) {
-                percolationScalar->get(xyz) = negInfForUndefined.get()
-                                                  ? -std::numeric_limits<double>::max()
-                                                  : undefinedValue.get();
-                continue;
-            }
-
-            // Divide by RMS.
-            const std::array<double, 3>& velocityXYZ = velocity->get<std::array<double, 3>>(xyz);
-            const std::array<double, 3>& AvgVelocityXYZ =
-                avgVelocity->get<std::array<double, 3>>(xyz);
-            double scalar = abs(_currentScalar.second(AvgVelocityXYZ, velocityXYZ));
-            percolationScalar->get(xyz) = scalar / rms;
+    if (sourcePlane) {
+        const ind NumVertices = sourcePlane->size();
+        bool inRange = true;
+#pragma omp parallel for reduction(&& : inRange)
+        for (ind xyz = 0; xyz < NumVertices; ++xyz) {
+            int plane;
+            sourcePlane->fill(plane, xyz);
+            inRange = inRange && plane >= 0 && static_cast<size_t>(plane) < rms.GetNumValues();
+        }
+        if (!inRange) {
+            LogWarn("The rms file does not cover the loaded region. Aborting.");
+            return;
+        }
+    }
+
+    // Transform velocity into selected scalar, in the precision it was loaded with.
+    auto velocity = inData->getChannel("Velocity", GridPrimitive::Vertex);
+    auto avgVelocity = inData->getChannel("AveragedVelocity", GridPrimitive::Vertex);
+    auto velocityDouble = std::dynamic_pointer_cast<const BufferChannel<double, 3>>(velocity);
+    auto avgVelocityDouble =
+        std::dynamic_pointer_cast<const BufferChannel<double, 3>>(avgVelocity);
+    auto velocityFloat = std::dynamic_pointer_cast<const BufferChannel<float, 3>>(velocity);
+    auto avgVelocityFloat = std::dynamic_pointer_cast<const BufferChannel<float, 3>>(avgVelocity);
+
+    auto transform = [&](const auto& planeIndex) -> std::shared_ptr<Channel> {
+        if (velocityDouble && avgVelocityDouble) {
+            const double undefined = negInfForUndefined.get()
+                                         ? -std::numeric_limits<double>::max()
+                                         : undefinedValue.get();
+            return transformVelocity<double>(*velocityDouble, *avgVelocityDouble,
+                                             _currentScalar.second, rms, planeIndex, undefined);
+        }
+        if (velocityFloat && avgVelocityFloat) {
+            // The sentinel is the lowest float, so that masking recognizes it.
+            const float undefined = negInfForUndefined.get()
+                                        ? std::numeric_limits<float>::lowest()
+                                        : static_cast<float>(undefinedValue.get());
+            return transformVelocity<float>(*velocityFloat, *avgVelocityFloat,
+                                            _currentScalar.second, rms, planeIndex, undefined);
         }
+        return nullptr;
+    };
+
+    std::shared_ptr<Channel> percolationScalar;
+    if (sourcePlane) {
+        percolationScalar = transform([&sourcePlane](const ind xyz) {
+            int plane;
+            sourcePlane->fill(plane, xyz);
+            return static_cast<ind>(plane);
+        });
+    } else {
+        percolationScalar = transform([numVertsXY](const ind xyz) { return xyz % numVertsXY; });
+    }
+    if (!percolationScalar) {
+        LogWarn("No velocity buffers of matching precision. Aborting.");
+        return;
+    }
+
+    // The scalar derives from the velocity, its average and the rms.
+    percolation::addSourceFiles(*percolationScalar, percolation::getSourceFiles(*velocity));
+    percolation::addSourceFiles(*percolationScalar, percolation::getSourceFiles(*avgVelocity));
+    percolation::addSourceFiles(*percolationScalar, {rmsName.get()});
+    const int TimeSlice = percolation::getTimeSlice(*velocity);
+    if (TimeSlice >= 0) percolation::setTimeSlice(*percolationScalar, TimeSlice);
 
     // Finished, add to output.
     outData->addChannel(percolationScalar);
@@ -0,0 +1,100 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/channels/bufferchannel.h>
+
+#ifndef __clang__
+#include <omp.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+using namespace discretedata;
+
+/** \class ContiguousChannelData
+    \brief Contiguous read-only view on the values of a scalar channel.
+
+    Buffer channels already hold their values in one vector, so we point into it directly.
+    All other channels (analytic, derived, ...) are copied into an internal vector.
+    That is still one virtual fill() per element, the blocks only spread the calls over threads.
+    Either way, consumers get a plain array they can index.
+*/
+template <typename T>
+class ContiguousChannelData {
+public:
+    /// Number of elements filled per thread and block for channels that are not buffer-backed.
+    static constexpr ind DefaultBlockSize = 1 << 16;
+
+    explicit ContiguousChannelData(const DataChannel<T, 1>& channel,
+                                   const ind blockSize = DefaultBlockSize)
+        : Data(nullptr), Size(channel.size()) {
+        // Zero-copy for buffers.
+        if (const auto* buffer = dynamic_cast<const BufferChannel<T, 1>*>(&channel)) {
+            Data = buffer->data().data();
+            return;
+        }
+
+        // Block-fill everything else.
+        Storage.resize(Size);
+        const ind BlockSize = std::max(blockSize, ind(1));
+        const ind NumBlocks = (Size + BlockSize - 1) / BlockSize;
+
+#pragma omp parallel for schedule(dynamic)
+        for (ind block = 0; block < NumBlocks; ++block) {
+            const ind blockEnd = std::min(Size, (block + 1) * BlockSize);
+            for (ind idx = block * BlockSize; idx < blockEnd; ++idx) channel.fill(Storage[idx], idx);
+        }
+        Data = Storage.data();
+    }
+
+    ContiguousChannelData(const ContiguousChannelData&) = delete;
+    ContiguousChannelData& operator=(const ContiguousChannelData&) = delete;
+    ContiguousChannelData(ContiguousChannelData&&) = default;
+    ContiguousChannelData& operator=(ContiguousChannelData&&) = default;
+
+    const T& operator[](const ind idx) const { return Data[idx]; }
+    const T* data() const { return Data; }
+    ind size() const { return Size; }
+
+    /// Whether we reference the channel's own memory.
+    bool isZeroCopy() const { return Storage.empty() && Size > 0; }
+
+private:
+    /// Filled values, empty when referencing a buffer directly.
+    std::vector<T> Storage;
+    const T* Data;
+    ind Size;
+};
+
+/** \class ChannelElementAccess
+    \brief Same indexing interface as ContiguousChannelData, but fills each value on request.
+
+    For channels that should not be materialized, e.g., a constant analytic volume
+    on an out-of-core sized grid.
+*/
+template <typename T>
+class ChannelElementAccess {
+public:
+    explicit ChannelElementAccess(const DataChannel<T, 1>& channel) : Channel(channel) {}
+
+    T operator[](const ind idx) const {
+        T value;
+        Channel.fill(value, idx);
+        return value;
+    }
+    ind size() const { return Channel.size(); }
+
+private:
+    const DataChannel<T, 1>& Channel;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
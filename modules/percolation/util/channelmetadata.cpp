@@ -0,0 +1,49 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <percolation/util/channelmetadata.h>
+#include <inviwo/core/metadata/metadata.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace inviwo {
+namespace percolation {
+
+namespace {
+const std::string SourceFilesKey = "SourceFiles";
+const std::string TimeSliceKey = "TimeSlice";
+}  // namespace
+
+void addSourceFiles(Channel& channel, const std::vector<std::string>& fileNames) {
+    std::vector<std::string> All = getSourceFiles(channel);
+    for (const auto& Name : fileNames)
+        if (std::find(All.begin(), All.end(), Name) == All.end()) All.push_back(Name);
+
+    std::string Joined;
+    for (const auto& Name : All) Joined += Name + '\n';
+    channel.setMetaData<StringMetaData>(SourceFilesKey, Joined);
+}
+
+std::vector<std::string> getSourceFiles(const Channel& channel) {
+    std::vector<std::string> Names;
+    std::istringstream Lines(channel.getMetaData<StringMetaData>(SourceFilesKey, std::string()));
+    for (std::string Line; std::getline(Lines, Line);)
+        if (!Line.empty()) Names.push_back(Line);
+    return Names;
+}
+
+void setTimeSlice(Channel& channel, const int timeSlice) {
+    channel.setMetaData<IntMetaData>(TimeSliceKey, timeSlice);
+}
+
+int getTimeSlice(const Channel& channel) {
+    return channel.getMetaData<IntMetaData>(TimeSliceKey, -1);
+}
+
+}  // namespace percolation
+}  // namespace inviwo
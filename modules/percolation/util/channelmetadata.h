@@ -0,0 +1,37 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/channels/channel.h>
+
+#include <string>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+using namespace discretedata;
+
+/// Records files a channel was derived from in its meta data, one path per line.
+/// The writer of a cache file takes them as the sources to check on reload.
+IVW_MODULE_PERCOLATION_API void addSourceFiles(Channel& channel,
+                                               const std::vector<std::string>& fileNames);
+
+/// Files a channel was derived from, see addSourceFiles.
+IVW_MODULE_PERCOLATION_API std::vector<std::string> getSourceFiles(const Channel& channel);
+
+/// Records the time slice a channel was loaded from.
+IVW_MODULE_PERCOLATION_API void setTimeSlice(Channel& channel, const int timeSlice);
+
+/// Time slice a channel was loaded from, -1 if not known.
+IVW_MODULE_PERCOLATION_API int getTimeSlice(const Channel& channel);
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,116 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef __clang__
+#include <omp.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+
+/// Largest value range that is sorted by counting, independent of the number of values
+constexpr std::uint64_t CountingSortMinRange = std::uint64_t(1) << 16;
+
+/// Values per histogram counter at least, beyond CountingSortMinRange.
+/// Keeps the histograms small against the sorted pairs.
+constexpr std::uint64_t CountingSortValuesPerBucket = 8;
+
+/// Whether countingSortDescending is used for values of this type and range.
+/// All 8 and 16 bit integers qualify. Wider integers need a range below an eighth of the
+/// number of values, otherwise the comparison sort is used.
+template <typename T>
+bool useCountingSort(const T minValue, const T maxValue, const std::uint64_t numValues) {
+    if (!std::is_integral<T>::value) return false;
+    if (sizeof(T) <= 2) return true;
+    // Modular arithmetic gives the right difference for signed values as well.
+    const std::uint64_t Range =
+        static_cast<std::uint64_t>(maxValue) - static_cast<std::uint64_t>(minValue);
+    return Range < std::max(CountingSortMinRange, numValues / CountingSortValuesPerBucket);
+}
+
+/** Orders all active values decreasingly, ties by decreasing index.
+    Same order as the comparison sort. O(n + range) for integer values in [minValue, maxValue].
+    The values are read through any random-access container, the result is (value, index).
+    isActive(index) tells whether a vertex takes part at all.
+*/
+template <typename T, typename TIndex, typename TValues, typename TActive>
+void countingSortDescending(const TValues& values, const std::uint64_t numValues,
+                            const T minValue, const T maxValue,
+                            std::vector<std::pair<T, TIndex>>& sorted, const TActive& isActive) {
+    const std::uint64_t Max = static_cast<std::uint64_t>(maxValue);
+    const std::uint64_t Range = Max - static_cast<std::uint64_t>(minValue) + 1;
+
+    // Chunks of indices are counted and placed in parallel, each with a histogram of its own.
+    // All histograms together take at most one counter per CountingSortValuesPerBucket values.
+    std::int64_t NumChunks = 1;
+#ifndef __clang__
+    NumChunks = std::max<std::int64_t>(
+        1, std::min<std::int64_t>(omp_get_max_threads(),
+                                  numValues / CountingSortValuesPerBucket / Range));
+#endif
+    auto chunkBegin = [numValues, NumChunks](const std::int64_t chunk) {
+        return numValues * static_cast<std::uint64_t>(chunk) / NumChunks;
+    };
+
+    // Histograms, bucket 0 holds the largest value.
+    std::vector<std::vector<std::uint64_t>> Offsets(NumChunks);
+#pragma omp parallel for schedule(static, 1)
+    for (std::int64_t chunk = 0; chunk < NumChunks; ++chunk) {
+        std::vector<std::uint64_t>& Count = Offsets[chunk];
+        Count.assign(Range, 0);
+        for (std::uint64_t id = chunkBegin(chunk); id < chunkBegin(chunk + 1); ++id) {
+            if (isActive(id)) Count[Max - static_cast<std::uint64_t>(values[id])]++;
+        }
+    }
+
+    // First position per bucket and chunk. Within a bucket, later chunks hold larger indices
+    // and come first.
+    std::uint64_t Position = 0;
+    for (std::uint64_t bucket = 0; bucket < Range; ++bucket) {
+        for (std::int64_t chunk = NumChunks; chunk-- > 0;) {
+            const std::uint64_t Count = Offsets[chunk][bucket];
+            Offsets[chunk][bucket] = Position;
+            Position += Count;
+        }
+    }
+
+    // Place. Running over the indices backwards puts larger indices first within a value.
+    sorted.resize(Position);
+#pragma omp parallel for schedule(static, 1)
+    for (std::int64_t chunk = 0; chunk < NumChunks; ++chunk) {
+        std::vector<std::uint64_t>& Offset = Offsets[chunk];
+        for (std::uint64_t id = chunkBegin(chunk + 1); id-- > chunkBegin(chunk);) {
+            if (!isActive(id)) continue;
+            const T Value = values[id];
+            const std::uint64_t Bucket = Max - static_cast<std::uint64_t>(Value);
+            sorted[Offset[Bucket]++] = std::make_pair(Value, static_cast<TIndex>(id));
+        }
+    }
+}
+
+/// Orders all values, see above.
+template <typename T, typename TIndex, typename TValues>
+void countingSortDescending(const TValues& values, const std::uint64_t numValues,
+                            const T minValue, const T maxValue,
+                            std::vector<std::pair<T, TIndex>>& sorted) {
+    countingSortDescending(values, numValues, minValue, maxValue, sorted,
+                           [](std::uint64_t) { return true; });
+}
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,109 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/connectivity/structuredgrid.h>
+#include <percolation/util/vertexmask.h>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+#ifndef __clang__
+#include <omp.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+using namespace discretedata;
+
+/// How the scalars of one block are combined into a coarse vertex.
+enum class Pooling { Min, Max, Mean };
+
+/// Scalar and volume of a downsampled lattice.
+template <typename T>
+struct DownsampledField {
+    std::vector<T> Values;
+    std::vector<double> Volumes;
+    std::array<ind, 3> Size;
+};
+
+/** Downsamples a scalar on a 3D lattice by an integer factor per dimension.
+
+    Each coarse vertex covers a block of factor^3 fine vertices (less at the upper borders).
+    Scalars are pooled as selected, volumes are summed so that the total volume is preserved.
+    Excluded vertices (lowest value of a floating-point T, see ScalarTransform, or not finite)
+    do not contribute to the mean, a block of only excluded vertices stays excluded.
+    Integer scalars have no excluded value, a 0 is averaged like any other value.
+    isCancelled is polled per coarse plane. Once it returns true, the result is incomplete.
+*/
+template <typename T, typename TVolumes, typename TCancelled>
+DownsampledField<T> downsampleLattice(const T* values, const TVolumes& volumes,
+                                      const std::array<ind, 3>& size, const ind factor,
+                                      const Pooling pooling, const TCancelled& isCancelled) {
+    DownsampledField<T> Coarse;
+    for (int dim = 0; dim < 3; ++dim) Coarse.Size[dim] = (size[dim] + factor - 1) / factor;
+
+    const ind NumCoarse = Coarse.Size[0] * Coarse.Size[1] * Coarse.Size[2];
+    Coarse.Values.resize(NumCoarse);
+    Coarse.Volumes.resize(NumCoarse);
+
+#pragma omp parallel for
+    for (ind cz = 0; cz < Coarse.Size[2]; ++cz) {
+        if (isCancelled()) continue;
+        for (ind cy = 0; cy < Coarse.Size[1]; ++cy) {
+            for (ind cx = 0; cx < Coarse.Size[0]; ++cx) {
+                double Min = std::numeric_limits<double>::max();
+                double Max = std::numeric_limits<double>::lowest();
+                double Sum = 0;
+                double Volume = 0;
+                ind Count = 0;
+
+                const ind zEnd = std::min(size[2], (cz + 1) * factor);
+                const ind yEnd = std::min(size[1], (cy + 1) * factor);
+                const ind xEnd = std::min(size[0], (cx + 1) * factor);
+                for (ind z = cz * factor; z < zEnd; ++z)
+                    for (ind y = cy * factor; y < yEnd; ++y)
+                        for (ind x = cx * factor; x < xEnd; ++x) {
+                            const ind fineIdx = x + size[0] * (y + size[1] * z);
+                            const double value = static_cast<double>(values[fineIdx]);
+                            Min = std::min(Min, value);
+                            Max = std::max(Max, value);
+                            Volume += volumes[fineIdx];
+                            if (isRegularValue(values[fineIdx])) {
+                                Sum += value;
+                                Count++;
+                            }
+                        }
+
+                const ind coarseIdx = cx + Coarse.Size[0] * (cy + Coarse.Size[1] * cz);
+                switch (pooling) {
+                    case Pooling::Min:
+                        Coarse.Values[coarseIdx] = static_cast<T>(Min);
+                        break;
+                    case Pooling::Max:
+                        Coarse.Values[coarseIdx] = static_cast<T>(Max);
+                        break;
+                    default:
+                        Coarse.Values[coarseIdx] = Count > 0 ? static_cast<T>(Sum / Count)
+                                                             : std::numeric_limits<T>::lowest();
+                        break;
+                }
+                Coarse.Volumes[coarseIdx] = Volume;
+            }
+        }
+    }
+
+    return Coarse;
+}
+
+}  // namespace percolation
+}  // namespace inviwo
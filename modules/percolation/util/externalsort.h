@@ -0,0 +1,203 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class ExternalSorter
+    \brief Sorts more records than fit into memory using sorted runs on disk.
+
+    Records are collected until the memory budget is reached,
+    then sorted and written as a run into the scratch folder.
+    Finish() merges all runs in a stream into one sorted output file.
+    At no point more than the budget (plus one read buffer per run) is held in memory.
+
+    Records need to be trivially copyable in practice, since they are written as raw bytes.
+*/
+template <typename TRecord, typename TCompare>
+class ExternalSorter {
+public:
+    ExternalSorter(const std::string& scratchFolder, const size_t maxRecordsInMemory,
+                   TCompare compare = TCompare())
+        : ScratchFolder(scratchFolder)
+        , MaxRecordsInMemory(std::max(maxRecordsInMemory, size_t(2)))
+        , Compare(compare)
+        , NumRecords(0)
+        , NumRunsWritten(0)
+        , Failed(false) {
+        static_assert(std::is_standard_layout<TRecord>::value,
+                      "Records are written to disk as raw bytes.");
+        Buffer.reserve(MaxRecordsInMemory);
+    }
+
+    virtual ~ExternalSorter() { RemoveRuns(); }
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    /// Adds a record. Writes a sorted run once the memory budget is used up.
+    void Add(const TRecord& record) {
+        Buffer.push_back(record);
+        NumRecords++;
+        if (Buffer.size() >= MaxRecordsInMemory) WriteRun();
+    }
+
+    /// Merges everything added so far into one sorted file. Returns false on I/O failure.
+    bool Finish(const std::string& outFileName) {
+        // Only one run? Sort in memory.
+        if (Runs.empty()) {
+            std::sort(Buffer.begin(), Buffer.end(), Compare);
+            const bool success = WriteRecords(outFileName, Buffer) && !Failed;
+            ReleaseBuffer();
+            return success;
+        }
+
+        if (!Buffer.empty()) WriteRun();
+        ReleaseBuffer();
+        if (Failed) return false;
+
+        // One input buffer per run, sharing the memory budget.
+        const size_t NumRuns = Runs.size();
+        const size_t RecordsPerRead = std::max(MaxRecordsInMemory / (NumRuns + 1), size_t(1));
+
+        std::vector<RunReader> Readers(NumRuns);
+        for (size_t run = 0; run < NumRuns; ++run) {
+            if (!Readers[run].Open(Runs[run], RecordsPerRead)) return false;
+        }
+
+        // Heap of (record, run). The comparison is inverted, so that the smallest is on top.
+        auto HeapCompare = [this](const std::pair<TRecord, size_t>& a,
+                                  const std::pair<TRecord, size_t>& b) {
+            return Compare(b.first, a.first);
+        };
+        std::priority_queue<std::pair<TRecord, size_t>, std::vector<std::pair<TRecord, size_t>>,
+                            decltype(HeapCompare)>
+            Heap(HeapCompare);
+
+        TRecord record;
+        for (size_t run = 0; run < NumRuns; ++run) {
+            if (Readers[run].Next(record)) Heap.push(std::make_pair(record, run));
+        }
+
+        std::ofstream outFile(outFileName, std::ios::binary | std::ios::trunc);
+        if (!outFile.is_open()) return false;
+
+        std::vector<TRecord> OutBuffer;
+        OutBuffer.reserve(RecordsPerRead);
+        while (!Heap.empty()) {
+            const size_t run = Heap.top().second;
+            OutBuffer.push_back(Heap.top().first);
+            Heap.pop();
+
+            if (Readers[run].Next(record)) Heap.push(std::make_pair(record, run));
+
+            if (OutBuffer.size() == RecordsPerRead) {
+                outFile.write(reinterpret_cast<const char*>(OutBuffer.data()),
+                              OutBuffer.size() * sizeof(TRecord));
+                OutBuffer.clear();
+            }
+        }
+        outFile.write(reinterpret_cast<const char*>(OutBuffer.data()),
+                      OutBuffer.size() * sizeof(TRecord));
+        const bool success = static_cast<bool>(outFile);
+        outFile.close();
+
+        Readers.clear();
+        RemoveRuns();
+        return success;
+    }
+
+    size_t GetNumRecords() const { return NumRecords; }
+    /// Number of sorted runs that were written to disk.
+    size_t GetNumRuns() const { return NumRunsWritten; }
+
+private:
+    /// Buffered sequential reading of one run.
+    struct RunReader {
+        bool Open(const std::string& fileName, const size_t recordsPerRead) {
+            File.open(fileName, std::ios::binary);
+            Records.resize(recordsPerRead);
+            return File.is_open();
+        }
+
+        bool Next(TRecord& record) {
+            if (Position == Available) {
+                if (!File) return false;
+                File.read(reinterpret_cast<char*>(Records.data()),
+                          Records.size() * sizeof(TRecord));
+                Available = static_cast<size_t>(File.gcount()) / sizeof(TRecord);
+                Position = 0;
+                if (Available == 0) return false;
+            }
+            record = Records[Position++];
+            return true;
+        }
+
+        std::ifstream File;
+        std::vector<TRecord> Records;
+        size_t Position = 0;
+        size_t Available = 0;
+    };
+
+    void WriteRun() {
+        std::sort(Buffer.begin(), Buffer.end(), Compare);
+        const std::string runName = ScratchFolder + "/percolation_run_" +
+                                    std::to_string(reinterpret_cast<std::uintptr_t>(this)) + "_" +
+                                    std::to_string(Runs.size()) + ".bin";
+        if (!WriteRecords(runName, Buffer)) Failed = true;
+        Runs.push_back(runName);
+        NumRunsWritten++;
+        Buffer.clear();
+    }
+
+    static bool WriteRecords(const std::string& fileName, const std::vector<TRecord>& records) {
+        std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+        file.write(reinterpret_cast<const char*>(records.data()),
+                   records.size() * sizeof(TRecord));
+        return static_cast<bool>(file);
+    }
+
+    void ReleaseBuffer() { std::vector<TRecord>().swap(Buffer); }
+
+    void RemoveRuns() {
+        for (const auto& run : Runs) std::remove(run.c_str());
+        Runs.clear();
+    }
+
+    // Attributes
+private:
+    std::string ScratchFolder;
+    size_t MaxRecordsInMemory;
+    TCompare Compare;
+
+    /// Records of the current run
+    std::vector<TRecord> Buffer;
+    /// File names of all runs written so far
+    std::vector<std::string> Runs;
+
+    size_t NumRecords;
+    size_t NumRunsWritten;
+    bool Failed;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
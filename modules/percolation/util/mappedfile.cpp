@@ -0,0 +1,215 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <percolation/util/mappedfile.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+
+MappedFile::MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this == &other) return *this;
+    Close();
+
+    std::swap(Data, other.Data);
+    std::swap(Size, other.Size);
+    std::swap(FileName, other.FileName);
+    std::swap(DeleteOnClose, other.DeleteOnClose);
+#ifdef _WIN32
+    std::swap(FileHandle, other.FileHandle);
+    std::swap(MappingHandle, other.MappingHandle);
+#else
+    std::swap(FileDescriptor, other.FileDescriptor);
+#endif
+    return *this;
+}
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const std::string& fileName, const bool writable, const bool deleteOnClose) {
+    Close();
+    FileName = fileName;
+    DeleteOnClose = deleteOnClose;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                              FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    FileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        Close();
+        return false;
+    }
+    Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    FileDescriptor = ::open(fileName.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (FileDescriptor < 0) return false;
+
+    struct stat fileStat;
+    if (::fstat(FileDescriptor, &fileStat) != 0) {
+        Close();
+        return false;
+    }
+    Size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+    return Map(writable);
+}
+
+bool MappedFile::Create(const std::string& fileName, const size_t numBytes,
+                        const bool deleteOnClose) {
+    Close();
+    FileName = fileName;
+    DeleteOnClose = deleteOnClose;
+    Size = numBytes;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    FileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    fileSize.QuadPart = static_cast<LONGLONG>(numBytes);
+    if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+        Close();
+        return false;
+    }
+#else
+    FileDescriptor = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (FileDescriptor < 0) return false;
+
+    if (::ftruncate(FileDescriptor, static_cast<off_t>(numBytes)) != 0) {
+        Close();
+        return false;
+    }
+#endif
+
+    return Map(true);
+}
+
+bool MappedFile::Map(const bool writable) {
+    // Empty files cannot be mapped.
+    if (Size == 0) {
+        Close();
+        return false;
+    }
+
+#ifdef _WIN32
+    MappingHandle = CreateFileMappingA(static_cast<HANDLE>(FileHandle), nullptr,
+                                       writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+    if (!MappingHandle) {
+        Close();
+        return false;
+    }
+    void* mapped = MapViewOfFile(static_cast<HANDLE>(MappingHandle),
+                                 writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, Size);
+    if (!mapped) {
+        Close();
+        return false;
+    }
+#else
+    void* mapped = ::mmap(nullptr, Size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                          FileDescriptor, 0);
+    if (mapped == MAP_FAILED) {
+        Close();
+        return false;
+    }
+#endif
+
+    Data = static_cast<char*>(mapped);
+    return true;
+}
+
+namespace {
+constexpr size_t PageSize = 4096;
+}
+
+void MappedFile::Prefetch(const size_t offset, const size_t numBytes) const {
+    if (!Data || offset >= Size || numBytes == 0) return;
+    const size_t Begin = offset - offset % PageSize;
+    const size_t End = std::min(Size, offset + numBytes);
+
+#ifndef _WIN32
+    ::madvise(Data + Begin, End - Begin, MADV_WILLNEED);
+#endif
+
+    // Touch one byte per page to fault it in.
+    volatile char Sink = 0;
+    for (size_t pos = Begin; pos < End; pos += PageSize) Sink = Sink ^ Data[pos];
+    Sink = Sink ^ Data[End - 1];
+}
+
+void MappedFile::Release(const size_t offset, const size_t numBytes) const {
+    if (!Data || offset >= Size) return;
+    const size_t Begin = (offset + PageSize - 1) / PageSize * PageSize;
+    size_t End = std::min(Size, offset + numBytes);
+    if (End < Size) End -= End % PageSize;
+    if (End <= Begin) return;
+
+#ifdef _WIN32
+    // Read-only views are trimmed by the system under memory pressure anyway.
+#else
+    ::madvise(Data + Begin, End - Begin, MADV_DONTNEED);
+#endif
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+    if (Data) UnmapViewOfFile(Data);
+    if (MappingHandle) CloseHandle(static_cast<HANDLE>(MappingHandle));
+    if (FileHandle) CloseHandle(static_cast<HANDLE>(FileHandle));
+    MappingHandle = nullptr;
+    FileHandle = nullptr;
+#else
+    if (Data) ::munmap(Data, Size);
+    if (FileDescriptor >= 0) ::close(FileDescriptor);
+    FileDescriptor = -1;
+#endif
+
+    if (DeleteOnClose && !FileName.empty()) std::remove(FileName.c_str());
+
+    Data = nullptr;
+    Size = 0;
+    FileName.clear();
+    DeleteOnClose = false;
+}
+
+std::uint64_t GetAvailableMemory() {
+#ifdef _WIN32
+    MEMORYSTATUSEX Status;
+    Status.dwLength = sizeof(Status);
+    if (!GlobalMemoryStatusEx(&Status)) return 0;
+    return Status.ullAvailPhys;
+#elif defined(_SC_AVPHYS_PAGES)
+    const long NumPages = ::sysconf(_SC_AVPHYS_PAGES);
+    const long PageBytes = ::sysconf(_SC_PAGESIZE);
+    if (NumPages < 0 || PageBytes < 0) return 0;
+    return static_cast<std::uint64_t>(NumPages) * static_cast<std::uint64_t>(PageBytes);
+#else
+    return 0;
+#endif
+}
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,84 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <cstdint>
+#include <string>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class MappedFile
+    \brief A file mapped into memory, either read-only or writable.
+
+    Wraps mmap (POSIX) and file mappings (Windows).
+    Scratch files can be marked to be deleted once the mapping is closed.
+*/
+class IVW_MODULE_PERCOLATION_API MappedFile {
+    // Construction / Deconstruction
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    virtual ~MappedFile();
+
+    // Methods
+public:
+    /// Maps an existing file. Returns false if the file could not be opened or mapped.
+    bool Open(const std::string& fileName, const bool writable = false,
+              const bool deleteOnClose = false);
+
+    /// Creates (or truncates) a file of the given size and maps it writable.
+    bool Create(const std::string& fileName, const size_t numBytes,
+                const bool deleteOnClose = false);
+
+    /// Unmaps and closes the file. Deletes it, if so desired.
+    void Close();
+
+    /// Reads a range of the mapping into memory, page by page in file order.
+    /// The kernel is told to read ahead, so the pages arrive in large sequential requests.
+    void Prefetch(const size_t offset, const size_t numBytes) const;
+    void Prefetch() const { Prefetch(0, Size); }
+
+    /// Drops the pages fully inside the range from this process. They are read again on access.
+    void Release(const size_t offset, const size_t numBytes) const;
+
+    bool IsOpen() const { return Data != nullptr; }
+    char* GetData() { return Data; }
+    const char* GetData() const { return Data; }
+    size_t GetSize() const { return Size; }
+    const std::string& GetFileName() const { return FileName; }
+
+private:
+    bool Map(const bool writable);
+
+    // Attributes
+private:
+    char* Data = nullptr;
+    size_t Size = 0;
+    std::string FileName;
+    bool DeleteOnClose = false;
+
+#ifdef _WIN32
+    void* FileHandle = nullptr;
+    void* MappingHandle = nullptr;
+#else
+    int FileDescriptor = -1;
+#endif
+};
+
+/// Physical memory currently available, in bytes. 0 if the system does not tell.
+IVW_MODULE_PERCOLATION_API std::uint64_t GetAvailableMemory();
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,397 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <percolation/util/percolationcache.h>
+#include <inviwo/core/util/filesystem.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace inviwo {
+namespace percolation {
+
+using namespace cachefile;
+
+namespace {
+/// Number of chunks encoded at once before they are written
+constexpr size_t ChunkBatch = 32;
+
+/// FNV-1a over 64 bit words, the remaining bytes one by one
+std::uint64_t checksum(const char* data, const size_t numBytes) {
+    constexpr std::uint64_t Prime = 0x100000001b3ull;
+    std::uint64_t Hash = 0xcbf29ce484222325ull;
+    size_t pos = 0;
+    for (; pos + 8 <= numBytes; pos += 8) {
+        std::uint64_t Word;
+        std::memcpy(&Word, data + pos, 8);
+        Hash = (Hash ^ Word) * Prime;
+    }
+    for (; pos < numBytes; ++pos) Hash = (Hash ^ static_cast<std::uint8_t>(data[pos])) * Prime;
+    return Hash;
+}
+
+/// Groups the bytes by their position within the element. The high bytes of similar values
+/// are then mostly equal and form runs.
+void shuffle(const char* in, const size_t numBytes, const size_t elementSize, char* out) {
+    const size_t NumElements = numBytes / elementSize;
+    for (size_t elem = 0; elem < NumElements; ++elem)
+        for (size_t byte = 0; byte < elementSize; ++byte)
+            out[byte * NumElements + elem] = in[elem * elementSize + byte];
+}
+
+void unshuffle(const char* in, const size_t numBytes, const size_t elementSize, char* out) {
+    const size_t NumElements = numBytes / elementSize;
+    for (size_t byte = 0; byte < elementSize; ++byte)
+        for (size_t elem = 0; elem < NumElements; ++elem)
+            out[elem * elementSize + byte] = in[byte * NumElements + elem];
+}
+
+/// Run-length coding: a control byte c < 128 is followed by c + 1 literal bytes,
+/// a control byte c >= 128 by one byte that repeats c - 125 times.
+constexpr size_t MinRun = 3;
+constexpr size_t MaxRun = 130;
+constexpr size_t MaxLiterals = 128;
+
+void runLengthEncode(const char* in, const size_t numBytes, std::vector<char>& out) {
+    out.clear();
+    size_t pos = 0;
+    size_t literalBegin = 0;
+    auto flushLiterals = [&](const size_t end) {
+        while (literalBegin < end) {
+            const size_t Count = std::min(MaxLiterals, end - literalBegin);
+            out.push_back(static_cast<char>(Count - 1));
+            out.insert(out.end(), in + literalBegin, in + literalBegin + Count);
+            literalBegin += Count;
+        }
+    };
+
+    while (pos < numBytes) {
+        size_t Run = 1;
+        while (pos + Run < numBytes && Run < MaxRun && in[pos + Run] == in[pos]) Run++;
+        if (Run >= MinRun) {
+            flushLiterals(pos);
+            out.push_back(static_cast<char>(Run - MinRun + 128));
+            out.push_back(in[pos]);
+            pos += Run;
+            literalBegin = pos;
+        } else {
+            pos += Run;
+        }
+    }
+    flushLiterals(numBytes);
+}
+
+bool runLengthDecode(const char* in, const size_t numStored, char* out, const size_t numBytes) {
+    size_t inPos = 0, outPos = 0;
+    while (inPos < numStored) {
+        const auto Control = static_cast<std::uint8_t>(in[inPos++]);
+        if (Control < 128) {
+            const size_t Count = size_t(Control) + 1;
+            if (inPos + Count > numStored || outPos + Count > numBytes) return false;
+            std::memcpy(out + outPos, in + inPos, Count);
+            inPos += Count;
+            outPos += Count;
+        } else {
+            const size_t Count = size_t(Control) - 128 + MinRun;
+            if (inPos >= numStored || outPos + Count > numBytes) return false;
+            std::memset(out + outPos, in[inPos++], Count);
+            outPos += Count;
+        }
+    }
+    return outPos == numBytes;
+}
+}  // namespace
+
+CacheFileWriter::~CacheFileWriter() { Discard(); }
+
+bool CacheFileWriter::Open(const std::string& fileName, const std::array<ind, 3>& dims,
+                           const std::array<bool, 3>& periodic) {
+    Discard();
+    TargetName = fileName;
+    TempName = fileName + ".tmp";
+    File.open(TempName, std::ios::binary | std::ios::trunc);
+    if (!File) {
+        Discard();
+        return false;
+    }
+
+    std::memset(&Header, 0, sizeof(Header));
+    std::memcpy(Header.Magic, Magic, sizeof(Magic));
+    Header.Version = Version;
+    Header.ByteOrder = ByteOrderMark;
+    for (int dim = 0; dim < 3; ++dim) {
+        Header.Dims[dim] = dims[dim];
+        Header.Periodic[dim] = periodic[dim] ? 1 : 0;
+    }
+    Sources.clear();
+    Sections.clear();
+    Chunks.clear();
+
+    // The header is written again on Close, once the tables are known.
+    File.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+    return static_cast<bool>(File);
+}
+
+void CacheFileWriter::AddSource(const std::string& fileName) {
+    Sources.emplace_back(static_cast<std::int64_t>(filesystem::fileModificationTime(fileName)),
+                         fileName);
+}
+
+bool CacheFileWriter::addSection(const SectionKind kind, const std::string& name,
+                                 const ElementType type, const char* values,
+                                 const size_t elementSize, const size_t numValues) {
+    if (!File) return false;
+
+    SectionEntry Section;
+    std::memset(&Section, 0, sizeof(Section));
+    std::strncpy(Section.Name, name.c_str(), sizeof(Section.Name) - 1);
+    Section.Kind = static_cast<std::uint32_t>(kind);
+    Section.Type = static_cast<std::uint32_t>(type);
+    Section.NumElements = numValues;
+    Section.ElementSize = elementSize;
+
+    const size_t ChunkElements = std::max(size_t(1), ChunkBytes / elementSize);
+    const size_t NumChunks = (numValues + ChunkElements - 1) / ChunkElements;
+    Section.NumChunks = NumChunks;
+
+    std::vector<ChunkEntry> Entries(NumChunks);
+    std::vector<std::vector<char>> Encoded(std::min(NumChunks, ChunkBatch));
+    for (size_t batchBegin = 0; batchBegin < NumChunks; batchBegin += ChunkBatch) {
+        const ind BatchSize = static_cast<ind>(std::min(ChunkBatch, NumChunks - batchBegin));
+
+#pragma omp parallel for schedule(dynamic)
+        for (ind local = 0; local < BatchSize; ++local) {
+            const size_t Chunk = batchBegin + local;
+            const size_t Begin = Chunk * ChunkElements;
+            const size_t RawBytes = (std::min(numValues, Begin + ChunkElements) - Begin) *
+                                    elementSize;
+            const char* Raw = values + Begin * elementSize;
+
+            ChunkEntry& Entry = Entries[Chunk];
+            std::memset(&Entry, 0, sizeof(Entry));
+            Entry.RawBytes = RawBytes;
+            Entry.StoredBytes = RawBytes;
+            Entry.Checksum = checksum(Raw, RawBytes);
+            Entry.Compression = static_cast<std::uint32_t>(Compression::None);
+            Encoded[local].clear();
+            if (!Compress) continue;
+
+            // Kept only if it is actually smaller.
+            std::vector<char> Shuffled(RawBytes);
+            shuffle(Raw, RawBytes, elementSize, Shuffled.data());
+            runLengthEncode(Shuffled.data(), RawBytes, Encoded[local]);
+            if (Encoded[local].size() < RawBytes) {
+                Entry.StoredBytes = Encoded[local].size();
+                Entry.Compression = static_cast<std::uint32_t>(Compression::ShuffleRunLength);
+            } else {
+                Encoded[local].clear();
+            }
+        }
+
+        for (ind local = 0; local < BatchSize; ++local) {
+            ChunkEntry& Entry = Entries[batchBegin + local];
+            Entry.Offset = static_cast<std::uint64_t>(File.tellp());
+            if (Entry.Compression == static_cast<std::uint32_t>(Compression::None))
+                File.write(values + (batchBegin + local) * ChunkElements * elementSize,
+                           Entry.RawBytes);
+            else
+                File.write(Encoded[local].data(), Entry.StoredBytes);
+        }
+        if (!File) return false;
+    }
+
+    Sections.push_back(Section);
+    Chunks.push_back(std::move(Entries));
+    return true;
+}
+
+bool CacheFileWriter::Close() {
+    if (!File.is_open()) return false;
+
+    Header.SourceTableOffset = static_cast<std::uint64_t>(File.tellp());
+    Header.NumSources = Sources.size();
+    for (const auto& Source : Sources) {
+        const std::uint64_t Length = Source.second.size();
+        File.write(reinterpret_cast<const char*>(&Source.first), sizeof(Source.first));
+        File.write(reinterpret_cast<const char*>(&Length), sizeof(Length));
+        File.write(Source.second.data(), Length);
+    }
+
+    for (size_t section = 0; section < Sections.size(); ++section) {
+        Sections[section].ChunkTableOffset = static_cast<std::uint64_t>(File.tellp());
+        File.write(reinterpret_cast<const char*>(Chunks[section].data()),
+                   Chunks[section].size() * sizeof(ChunkEntry));
+    }
+
+    Header.SectionTableOffset = static_cast<std::uint64_t>(File.tellp());
+    Header.NumSections = static_cast<std::uint32_t>(Sections.size());
+    File.write(reinterpret_cast<const char*>(Sections.data()),
+               Sections.size() * sizeof(SectionEntry));
+
+    File.seekp(0);
+    File.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+    File.close();
+    if (!File) {
+        Discard();
+        return false;
+    }
+
+    // Replaces the target at once where the platform allows, otherwise removes it first.
+    if (std::rename(TempName.c_str(), TargetName.c_str()) != 0) {
+        std::remove(TargetName.c_str());
+        if (std::rename(TempName.c_str(), TargetName.c_str()) != 0) {
+            Discard();
+            return false;
+        }
+    }
+    TempName.clear();
+    return true;
+}
+
+void CacheFileWriter::Discard() {
+    if (File.is_open()) File.close();
+    File.clear();
+    if (!TempName.empty()) std::remove(TempName.c_str());
+    TempName.clear();
+}
+
+bool CacheFileReader::Open(const std::string& fileName) {
+    Close();
+    if (!File.Open(fileName)) return false;
+
+    const size_t FileSize = File.GetSize();
+    const char* Data = File.GetData();
+    auto fail = [&](const char* reason) {
+        LogWarnCustom("CacheFileReader", fileName << ": " << reason);
+        Close();
+        return false;
+    };
+
+    if (FileSize < sizeof(Header)) return fail("Not a percolation cache file.");
+    std::memcpy(&Header, Data, sizeof(Header));
+    if (std::memcmp(Header.Magic, Magic, sizeof(Magic)) != 0)
+        return fail("Not a percolation cache file.");
+    if (Header.Version != Version) return fail("Written by another version, please rewrite.");
+    if (Header.ByteOrder != ByteOrderMark) return fail("Written in another byte order.");
+
+    // Source table
+    size_t pos = Header.SourceTableOffset;
+    for (std::uint64_t source = 0; source < Header.NumSources; ++source) {
+        std::int64_t Time;
+        std::uint64_t Length;
+        if (pos + sizeof(Time) + sizeof(Length) > FileSize) return fail("File is truncated.");
+        std::memcpy(&Time, Data + pos, sizeof(Time));
+        std::memcpy(&Length, Data + pos + sizeof(Time), sizeof(Length));
+        pos += sizeof(Time) + sizeof(Length);
+        if (Length > FileSize - pos) return fail("File is truncated.");
+        Sources.emplace_back(Time, std::string(Data + pos, Length));
+        pos += Length;
+    }
+
+    // Section table. The chunk tables are checked when a section is read.
+    if (Header.SectionTableOffset > FileSize ||
+        Header.NumSections > (FileSize - Header.SectionTableOffset) / sizeof(SectionEntry))
+        return fail("File is truncated.");
+    Sections.resize(Header.NumSections);
+    std::memcpy(Sections.data(), Data + Header.SectionTableOffset,
+                Sections.size() * sizeof(SectionEntry));
+    for (const auto& Section : Sections) {
+        if (Section.ElementSize != 4 && Section.ElementSize != 8)
+            return fail("Unknown element type.");
+        if (Section.ChunkTableOffset > FileSize ||
+            Section.NumChunks > (FileSize - Section.ChunkTableOffset) / sizeof(ChunkEntry))
+            return fail("File is truncated.");
+    }
+    return true;
+}
+
+void CacheFileReader::Close() {
+    File.Close();
+    Sources.clear();
+    Sections.clear();
+}
+
+std::array<ind, 3> CacheFileReader::GetDims() const {
+    return {Header.Dims[0], Header.Dims[1], Header.Dims[2]};
+}
+
+std::array<bool, 3> CacheFileReader::GetPeriodic() const {
+    return {Header.Periodic[0] != 0, Header.Periodic[1] != 0, Header.Periodic[2] != 0};
+}
+
+std::vector<std::string> CacheFileReader::GetSources() const {
+    std::vector<std::string> Names;
+    for (const auto& Source : Sources) Names.push_back(Source.second);
+    return Names;
+}
+
+std::vector<std::string> CacheFileReader::GetOutdatedSources() const {
+    std::vector<std::string> Outdated;
+    for (const auto& Source : Sources) {
+        if (!filesystem::fileExists(Source.second) ||
+            static_cast<std::int64_t>(filesystem::fileModificationTime(Source.second)) !=
+                Source.first)
+            Outdated.push_back(Source.second);
+    }
+    return Outdated;
+}
+
+const SectionEntry* CacheFileReader::FindSection(const SectionKind kind) const {
+    for (const auto& Section : Sections)
+        if (Section.Kind == static_cast<std::uint32_t>(kind)) return &Section;
+    return nullptr;
+}
+
+std::string CacheFileReader::GetName(const SectionEntry& section) {
+    return std::string(section.Name, strnlen(section.Name, sizeof(section.Name)));
+}
+
+bool CacheFileReader::Read(const SectionEntry& section, char* out) const {
+    const size_t FileSize = File.GetSize();
+    const char* Data = File.GetData();
+    const size_t NumBytes = section.NumElements * section.ElementSize;
+
+    // Chunk offsets into the decoded section
+    std::vector<ChunkEntry> Entries(section.NumChunks);
+    std::memcpy(Entries.data(), Data + section.ChunkTableOffset,
+                Entries.size() * sizeof(ChunkEntry));
+    std::vector<size_t> Begins(Entries.size() + 1, 0);
+    for (size_t chunk = 0; chunk < Entries.size(); ++chunk) {
+        const ChunkEntry& Entry = Entries[chunk];
+        if (Entry.Offset > FileSize || Entry.StoredBytes > FileSize - Entry.Offset ||
+            Entry.RawBytes % section.ElementSize != 0)
+            return false;
+        Begins[chunk + 1] = Begins[chunk] + Entry.RawBytes;
+    }
+    if (Begins.back() != NumBytes) return false;
+
+    bool Valid = true;
+    const ind NumChunks = static_cast<ind>(Entries.size());
+#pragma omp parallel for schedule(dynamic) reduction(&& : Valid)
+    for (ind chunk = 0; chunk < NumChunks; ++chunk) {
+        const ChunkEntry& Entry = Entries[chunk];
+        const char* Stored = Data + Entry.Offset;
+        char* Raw = out + Begins[chunk];
+
+        bool Decoded = false;
+        if (Entry.Compression == static_cast<std::uint32_t>(Compression::None)) {
+            Decoded = Entry.StoredBytes == Entry.RawBytes;
+            if (Decoded) std::memcpy(Raw, Stored, Entry.RawBytes);
+        } else if (Entry.Compression ==
+                   static_cast<std::uint32_t>(Compression::ShuffleRunLength)) {
+            std::vector<char> Shuffled(Entry.RawBytes);
+            Decoded = runLengthDecode(Stored, Entry.StoredBytes, Shuffled.data(), Entry.RawBytes);
+            if (Decoded) unshuffle(Shuffled.data(), Entry.RawBytes, section.ElementSize, Raw);
+        }
+        Valid = Valid && Decoded && checksum(Raw, Entry.RawBytes) == Entry.Checksum;
+    }
+    return Valid;
+}
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,237 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/channels/datachannel.h>
+#include <percolation/util/mappedfile.h>
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+using namespace discretedata;
+
+/** Layout of a percolation cache file, all in native byte order:
+
+        FileHeader
+        chunk payloads, section after section
+        source table:  per source, int64 modification time, uint64 length, path
+        chunk tables:  per section, NumChunks ChunkEntry
+        section table: NumSections SectionEntry
+
+    Each section is one array, split into chunks of whole elements.
+    Every chunk carries a checksum of its decoded bytes and may be compressed on its own,
+    so chunks are decoded in parallel and a damaged chunk is detected.
+*/
+namespace cachefile {
+
+constexpr char Magic[8] = {'P', 'E', 'R', 'C', 'C', 'A', 'C', 'H'};
+constexpr std::uint32_t Version = 1;
+constexpr std::uint32_t ByteOrderMark = 0x01020304;
+
+/// What a section holds
+enum class SectionKind : std::uint32_t {
+    /// The percolation scalar, its name is the channel name
+    Scalar,
+    /// Vertex indices in sweep order, see sortedorder.h
+    Order,
+    /// Volume per vertex. A single element stands for a constant volume.
+    Volume,
+    /// Dual cell widths along x, y and z. The volume is their product.
+    VolumeWidthX,
+    VolumeWidthY,
+    VolumeWidthZ,
+    /// Vertex coordinates along x, y and z of a rectilinear grid
+    AxisX,
+    AxisY,
+    AxisZ
+};
+
+enum class ElementType : std::uint32_t { Float32, Float64, Int32, Int64 };
+
+enum class Compression : std::uint32_t {
+    None,
+    /// Bytes grouped by their position within the element, then run-length coded
+    ShuffleRunLength
+};
+
+/// Element type of a value type, by kind and size
+template <typename T>
+struct ElementTypeOf {
+    static_assert(std::is_arithmetic<T>::value && (sizeof(T) == 4 || sizeof(T) == 8),
+                  "Sections hold 32 or 64 bit numbers.");
+    static constexpr ElementType Type =
+        std::is_floating_point<T>::value
+            ? (sizeof(T) == 4 ? ElementType::Float32 : ElementType::Float64)
+            : (sizeof(T) == 4 ? ElementType::Int32 : ElementType::Int64);
+};
+
+struct FileHeader {
+    char Magic[8];
+    std::uint32_t Version;
+    std::uint32_t ByteOrder;
+    std::int64_t Dims[3];
+    std::uint32_t Periodic[3];
+    std::uint32_t NumSections;
+    std::uint64_t NumSources;
+    std::uint64_t SourceTableOffset;
+    std::uint64_t SectionTableOffset;
+};
+
+struct SectionEntry {
+    char Name[64];
+    std::uint32_t Kind;
+    std::uint32_t Type;
+    std::uint64_t NumElements;
+    std::uint64_t ElementSize;
+    std::uint64_t NumChunks;
+    std::uint64_t ChunkTableOffset;
+};
+
+struct ChunkEntry {
+    std::uint64_t Offset;
+    std::uint64_t StoredBytes;
+    std::uint64_t RawBytes;
+    std::uint64_t Checksum;
+    std::uint32_t Compression;
+    std::uint32_t Reserved;
+};
+
+}  // namespace cachefile
+
+/** \class CacheFileWriter
+    \brief Writes a percolation cache file, section by section.
+
+    Chunks are encoded in parallel and appended as they are done,
+    the tables and the header follow on Close.
+    All is written to a temporary file next to the target, which replaces the target only once
+    it is complete. A failed or abandoned write leaves an existing cache file untouched.
+*/
+class IVW_MODULE_PERCOLATION_API CacheFileWriter {
+    // Construction / Deconstruction
+public:
+    CacheFileWriter() = default;
+    CacheFileWriter(const CacheFileWriter&) = delete;
+    CacheFileWriter& operator=(const CacheFileWriter&) = delete;
+    virtual ~CacheFileWriter();
+
+    // Methods
+public:
+    /// Creates the temporary file. Returns false if it could not be created.
+    bool Open(const std::string& fileName, const std::array<ind, 3>& dims,
+              const std::array<bool, 3>& periodic);
+
+    /// Records a file the cached data was derived from, with its current modification time.
+    void AddSource(const std::string& fileName);
+
+    /// Compress chunks where that makes them smaller
+    void SetCompression(const bool compress) { Compress = compress; }
+
+    /// Size of a chunk before compression, rounded down to whole elements
+    void SetChunkSize(const size_t numBytes) { ChunkBytes = numBytes; }
+
+    template <typename T>
+    bool AddSection(const cachefile::SectionKind kind, const std::string& name, const T* values,
+                    const size_t numValues) {
+        return addSection(kind, name, cachefile::ElementTypeOf<T>::Type,
+                          reinterpret_cast<const char*>(values), sizeof(T), numValues);
+    }
+
+    /// Writes the tables and the header, and moves the file to its place.
+    /// Returns false if anything failed to be written, the temporary file is removed then.
+    bool Close();
+
+    /// Removes the temporary file, leaving the target as it was.
+    void Discard();
+
+private:
+    bool addSection(const cachefile::SectionKind kind, const std::string& name,
+                    const cachefile::ElementType type, const char* values,
+                    const size_t elementSize, const size_t numValues);
+
+    // Attributes
+private:
+    std::ofstream File;
+    /// File to be written, and the temporary file written to until Close
+    std::string TargetName, TempName;
+    cachefile::FileHeader Header;
+    std::vector<std::pair<std::int64_t, std::string>> Sources;
+    std::vector<cachefile::SectionEntry> Sections;
+    std::vector<std::vector<cachefile::ChunkEntry>> Chunks;
+    bool Compress = false;
+    size_t ChunkBytes = size_t(4) << 20;
+};
+
+/** \class CacheFileReader
+    \brief Maps a percolation cache file and decodes its sections.
+*/
+class IVW_MODULE_PERCOLATION_API CacheFileReader {
+    // Construction / Deconstruction
+public:
+    CacheFileReader() = default;
+    CacheFileReader(const CacheFileReader&) = delete;
+    CacheFileReader& operator=(const CacheFileReader&) = delete;
+    virtual ~CacheFileReader() = default;
+
+    // Methods
+public:
+    /// Maps the file and reads its tables.
+    /// Returns false if it is missing, of another version or byte order, or truncated.
+    bool Open(const std::string& fileName);
+
+    void Close();
+
+    bool IsOpen() const { return File.IsOpen(); }
+
+    std::array<ind, 3> GetDims() const;
+    std::array<bool, 3> GetPeriodic() const;
+
+    /// Files the cached data was derived from
+    std::vector<std::string> GetSources() const;
+
+    /// Source files that are gone or were modified after the cache was written
+    std::vector<std::string> GetOutdatedSources() const;
+
+    /// First section of the given kind, null if there is none
+    const cachefile::SectionEntry* FindSection(const cachefile::SectionKind kind) const;
+
+    /// Name of a section, e.g., the name of the scalar channel
+    static std::string GetName(const cachefile::SectionEntry& section);
+
+    /// Decodes a section into out, which holds all of its elements.
+    /// Chunks are decoded in parallel and checked against their checksums.
+    /// Returns false on any mismatch.
+    bool Read(const cachefile::SectionEntry& section, char* out) const;
+
+    template <typename T>
+    bool Read(const cachefile::SectionEntry& section, std::vector<T>& out) const {
+        if (section.Type != static_cast<std::uint32_t>(cachefile::ElementTypeOf<T>::Type))
+            return false;
+        out.resize(section.NumElements);
+        return Read(section, reinterpret_cast<char*>(out.data()));
+    }
+
+    // Attributes
+private:
+    MappedFile File;
+    cachefile::FileHeader Header;
+    std::vector<std::pair<std::int64_t, std::string>> Sources;
+    std::vector<cachefile::SectionEntry> Sections;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
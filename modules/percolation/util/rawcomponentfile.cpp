@@ -0,0 +1,117 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <percolation/util/rawcomponentfile.h>
+
+#include <utility>
+
+namespace inviwo {
+namespace percolation {
+
+RawComponentFile::RawComponentFile(RawComponentFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+RawComponentFile& RawComponentFile::operator=(RawComponentFile&& other) noexcept {
+    if (this == &other) return *this;
+    Close();
+
+    // The mapping does not move in memory, so the payload pointer stays valid.
+    File = std::move(other.File);
+    std::swap(Payload, other.Payload);
+    std::swap(NumValues, other.NumValues);
+    std::swap(MarkerSize, other.MarkerSize);
+    std::swap(Swapped, other.Swapped);
+    return *this;
+}
+
+bool RawComponentFile::Open(const std::string& fileName, const size_t numValues) {
+    Close();
+    if (!File.Open(fileName)) return false;
+
+    const bool All = (numValues == 0);
+    const size_t FileSize = File.GetSize();
+    const size_t NumBytes = numValues * sizeof(double);
+
+    // Raw doubles without any record markers
+    if (!All && FileSize == NumBytes) {
+        Payload = File.GetData();
+        NumValues = numValues;
+        return true;
+    }
+
+    // One Fortran record: both markers hold the payload size.
+    for (size_t markerSize = 4; markerSize <= 8; markerSize += 4) {
+        if (FileSize < NumBytes + 2 * markerSize) continue;
+        const std::uint64_t RecordSize = FileSize - 2 * markerSize;
+        if (All && (RecordSize == 0 || RecordSize % sizeof(double) != 0)) continue;
+
+        for (const bool swapped : {false, true}) {
+            if (readMarker(0, markerSize, swapped) != RecordSize ||
+                readMarker(FileSize - markerSize, markerSize, swapped) != RecordSize)
+                continue;
+
+            Payload = File.GetData() + markerSize;
+            NumValues = All ? RecordSize / sizeof(double) : numValues;
+            MarkerSize = markerSize;
+            Swapped = swapped;
+            return true;
+        }
+    }
+
+    // Without markers, all of the file is taken.
+    if (All && FileSize % sizeof(double) == 0) {
+        Payload = File.GetData();
+        NumValues = FileSize / sizeof(double);
+        return true;
+    }
+
+    LogWarnCustom("RawComponentFile", "Could not determine the record layout of "
+                                          << fileName << " (" << FileSize << " bytes, expected "
+                                          << NumBytes << " bytes of payload).");
+    Close();
+    return false;
+}
+
+void RawComponentFile::Close() {
+    File.Close();
+    Payload = nullptr;
+    NumValues = 0;
+    MarkerSize = 0;
+    Swapped = false;
+}
+
+void RawComponentFile::CopyTo(double* out, const size_t begin, const size_t count) const {
+    std::memcpy(out, Payload + begin * sizeof(double), count * sizeof(double));
+    if (!Swapped) return;
+
+    for (size_t idx = 0; idx < count; ++idx) {
+        std::uint64_t Bits;
+        std::memcpy(&Bits, out + idx, sizeof(double));
+        Bits = SwapBytes(Bits);
+        std::memcpy(out + idx, &Bits, sizeof(double));
+    }
+}
+
+std::uint64_t RawComponentFile::readMarker(const size_t offset, const size_t size,
+                                           const bool swapped) const {
+    const char* Data = File.GetData() + offset;
+    std::uint64_t Marker = 0;
+    if (size == 4) {
+        std::uint32_t Value;
+        std::memcpy(&Value, Data, 4);
+        if (swapped) Value = static_cast<std::uint32_t>(SwapBytes(Value) >> 32);
+        Marker = Value;
+    } else {
+        std::memcpy(&Marker, Data, 8);
+        if (swapped) Marker = SwapBytes(Marker);
+    }
+    return Marker;
+}
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,112 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <percolation/util/mappedfile.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace inviwo {
+namespace percolation {
+
+/** \class RawComponentFile
+    \brief One component of a Nek5000 field, mapped read-only.
+
+    The file holds doubles, either raw or as a single Fortran record
+    with 4 or 8 byte markers before and after the payload.
+    The markers are checked in place. If they are in the other byte order,
+    the payload is as well, and values are swapped on access.
+    Nothing is copied, the values are read straight from the mapping.
+*/
+class IVW_MODULE_PERCOLATION_API RawComponentFile {
+    // Construction / Deconstruction
+public:
+    RawComponentFile() = default;
+    RawComponentFile(const RawComponentFile&) = delete;
+    RawComponentFile& operator=(const RawComponentFile&) = delete;
+    RawComponentFile(RawComponentFile&& other) noexcept;
+    RawComponentFile& operator=(RawComponentFile&& other) noexcept;
+    virtual ~RawComponentFile() = default;
+
+    // Methods
+public:
+    /// Maps the file and locates the payload. At least numValues doubles are expected,
+    /// a longer payload is accepted and only its first numValues are exposed.
+    /// With numValues = 0, all values the file holds are exposed.
+    /// Returns false if the file is missing or its layout does not fit.
+    bool Open(const std::string& fileName, const size_t numValues = 0);
+
+    void Close();
+
+    /// Reads the file into memory, see MappedFile::Prefetch.
+    void Prefetch() const { File.Prefetch(); }
+
+    /// Reads the values [begin, begin + count) into memory.
+    void Prefetch(const size_t begin, const size_t count) const {
+        File.Prefetch(MarkerSize + begin * sizeof(double), count * sizeof(double));
+    }
+
+    /// Drops the values [begin, begin + count) from memory again, once they have been converted.
+    void Release(const size_t begin, const size_t count) const {
+        File.Release(MarkerSize + begin * sizeof(double), count * sizeof(double));
+    }
+
+    bool IsOpen() const { return Payload != nullptr; }
+
+    /// Number of exposed values
+    size_t GetNumValues() const { return NumValues; }
+
+    /// Size of the record markers, 0 for a raw file
+    size_t GetMarkerSize() const { return MarkerSize; }
+
+    /// Whether the file is in the other byte order
+    bool IsSwapped() const { return Swapped; }
+
+    /// Payload bytes in file byte order, read-only
+    const char* GetPayload() const { return Payload; }
+    size_t GetPayloadSize() const { return NumValues * sizeof(double); }
+
+    /// Value at the given index, in native byte order.
+    double operator[](const size_t idx) const {
+        // Markers of 4 bytes leave the payload unaligned, hence the copy.
+        std::uint64_t Bits;
+        std::memcpy(&Bits, Payload + idx * sizeof(double), sizeof(double));
+        if (Swapped) Bits = SwapBytes(Bits);
+        double Value;
+        std::memcpy(&Value, &Bits, sizeof(double));
+        return Value;
+    }
+
+    /// Copies the values [begin, begin + count) into out, in native byte order.
+    void CopyTo(double* out, const size_t begin, const size_t count) const;
+
+    static std::uint64_t SwapBytes(std::uint64_t value) {
+        value = ((value & 0x00FF00FF00FF00FFull) << 8) | ((value >> 8) & 0x00FF00FF00FF00FFull);
+        value = ((value & 0x0000FFFF0000FFFFull) << 16) | ((value >> 16) & 0x0000FFFF0000FFFFull);
+        return (value << 32) | (value >> 32);
+    }
+
+private:
+    /// Reads a record marker of the given size at the given offset, optionally swapped.
+    std::uint64_t readMarker(const size_t offset, const size_t size, const bool swapped) const;
+
+    // Attributes
+private:
+    MappedFile File;
+    const char* Payload = nullptr;
+    size_t NumValues = 0;
+    size_t MarkerSize = 0;
+    bool Swapped = false;
+};
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,73 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/channels/datachannel.h>
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+using namespace discretedata;
+
+/// Coordinates along each axis, if the positions form a rectilinear grid.
+/// Positions built from intervals are rectilinear by construction, others are checked.
+inline bool rectilinearAxes(const DataChannel<double, 3>& positions, const size3_t dims,
+                            const bool verify, std::array<std::vector<double>, 3>& axes) {
+    const size_t Strides[3] = {1, dims.x, dims.x * dims.y};
+    std::array<double, 3> Pos;
+    for (int axis = 0; axis < 3; ++axis) {
+        axes[axis].resize(dims[axis]);
+        for (size_t i = 0; i < dims[axis]; ++i) {
+            positions.fill(Pos, i * Strides[axis]);
+            axes[axis][i] = Pos[axis];
+        }
+    }
+    if (!verify) return true;
+
+    const ind NumVertices = dims.x * dims.y * dims.z;
+    bool Rectilinear = true;
+#pragma omp parallel for reduction(&& : Rectilinear)
+    for (ind idx = 0; idx < NumVertices; ++idx) {
+        std::array<double, 3> Vertex;
+        positions.fill(Vertex, idx);
+        Rectilinear = Rectilinear && Vertex[0] == axes[0][idx % dims.x] &&
+                      Vertex[1] == axes[1][(idx / dims.x) % dims.y] &&
+                      Vertex[2] == axes[2][idx / (dims.x * dims.y)];
+    }
+    return Rectilinear;
+}
+
+/// Width of the dual cell of each vertex along one axis: half of each adjacent interval.
+/// A periodic axis closes with the interval between the last and the first vertex,
+/// measured the same way as the generic cell measure does.
+inline std::vector<double> dualWidths(const std::vector<double>& coords, const bool periodic) {
+    const size_t NumCoords = coords.size();
+    std::vector<double> Widths(NumCoords, 0.0);
+    if (NumCoords < 2) return Widths;
+
+    for (size_t i = 0; i + 1 < NumCoords; ++i) {
+        const double HalfInterval = std::abs(coords[i + 1] - coords[i]) / 2.0;
+        Widths[i] += HalfInterval;
+        Widths[i + 1] += HalfInterval;
+    }
+    if (periodic) {
+        const double HalfInterval = std::abs(coords[0] - coords[NumCoords - 1]) / 2.0;
+        Widths[0] += HalfInterval;
+        Widths[NumCoords - 1] += HalfInterval;
+    }
+    return Widths;
+}
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,142 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <modules/discretedata/channels/bufferchannel.h>
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace inviwo {
+namespace percolation {
+
+using namespace discretedata;
+
+/// Name of the channel holding the precomputed sweep order of a scalar channel
+inline std::string sortedOrderName(const std::string& channelName) {
+    return channelName + " Order";
+}
+
+/// Vertex indices by decreasing value, ties by decreasing index, exactly as the sweep sorts.
+template <typename TIndex, typename TValues>
+std::vector<TIndex> computeSortedOrder(const TValues& values, const ind numValues) {
+    using T = std::decay_t<decltype(values[0])>;
+    using ValuePair = std::pair<T, TIndex>;
+
+    std::vector<ValuePair> Pairs(numValues);
+#pragma omp parallel for
+    for (ind idx = 0; idx < numValues; ++idx)
+        Pairs[idx] = std::make_pair(values[idx], static_cast<TIndex>(idx));
+    std::sort(Pairs.begin(), Pairs.end(), [](const ValuePair& a, const ValuePair& b) {
+        return (a.first == b.first) ? (a.second > b.second) : (a.first > b.first);
+    });
+
+    std::vector<TIndex> Order(numValues);
+#pragma omp parallel for
+    for (ind idx = 0; idx < numValues; ++idx) Order[idx] = Pairs[idx].second;
+    return Order;
+}
+
+/** Sorts blocks in parallel and merges them pairwise, polling isCancelled between the steps.
+    Thus, a sweep in the background can be cancelled during its sort.
+    Returns false, leaving the range partially sorted, if cancelled.
+*/
+template <typename TIter, typename TCompare, typename TCancelled>
+bool sortCancellable(const TIter begin, const TIter end, const TCompare& compare,
+                     const TCancelled& isCancelled) {
+    const ind NumValues = static_cast<ind>(end - begin);
+
+    // A power of two, so that the merge tree is complete.
+    constexpr ind MinBlockSize = ind(1) << 16;
+    ind NumBlocks = 1;
+    while (NumBlocks < 64 && NumValues / (2 * NumBlocks) >= MinBlockSize) NumBlocks *= 2;
+    auto blockBegin = [begin, NumValues, NumBlocks](const ind block) {
+        return begin + NumValues * block / NumBlocks;
+    };
+
+    bool Cancelled = false;
+#pragma omp parallel for schedule(dynamic, 1) reduction(|| : Cancelled)
+    for (ind block = 0; block < NumBlocks; ++block) {
+        if (Cancelled || isCancelled()) {
+            Cancelled = true;
+            continue;
+        }
+        std::sort(blockBegin(block), blockBegin(block + 1), compare);
+    }
+    if (Cancelled) return false;
+
+    for (ind width = 1; width < NumBlocks; width *= 2) {
+        if (isCancelled()) return false;
+#pragma omp parallel for
+        for (ind block = 0; block < NumBlocks; block += 2 * width)
+            std::inplace_merge(blockBegin(block), blockBegin(block + width),
+                               blockBegin(block + 2 * width), compare);
+    }
+    return true;
+}
+
+/** Writes (value, index) of all active vertices to sorted, in a precomputed order.
+    The order is checked in parallel to be a permutation sorted the way the sweep sorts.
+    Returns false, leaving sorted empty, if it is not.
+*/
+template <typename T, typename TIndex, typename TOrder, typename TValues, typename TActive>
+bool gatherInOrder(const TOrder* order, const TValues& values, const ind numValues,
+                   const TActive& isActive, std::vector<std::pair<T, TIndex>>& sorted) {
+    using ValuePair = std::pair<T, TIndex>;
+
+    // One random access per vertex, the checks below run over the gathered pairs.
+    sorted.resize(numValues);
+    bool Valid = true;
+#pragma omp parallel for reduction(&& : Valid)
+    for (ind pos = 0; pos < numValues; ++pos) {
+        const ind Idx = static_cast<ind>(order[pos]);
+        const bool InRange = Idx >= 0 && Idx < numValues;
+        sorted[pos] = std::make_pair(InRange ? T(values[Idx]) : T(0), static_cast<TIndex>(Idx));
+        Valid = Valid && InRange;
+    }
+
+    // Strictly decreasing pairs with indices in range can only be a permutation.
+#pragma omp parallel for reduction(&& : Valid)
+    for (ind pos = 1; pos < numValues; ++pos) {
+        const ValuePair& a = sorted[pos - 1];
+        const ValuePair& b = sorted[pos];
+        Valid = Valid && ((a.first == b.first) ? (a.second > b.second) : (a.first > b.first));
+    }
+    if (!Valid) {
+        sorted.clear();
+        return false;
+    }
+
+    sorted.erase(std::remove_if(sorted.begin(), sorted.end(),
+                                [&isActive](const ValuePair& pair) {
+                                    return !isActive(static_cast<ind>(pair.second));
+                                }),
+                 sorted.end());
+    return true;
+}
+
+/// Same as above, for an order channel of int or ind indices.
+/// Returns false if the channel is of another type or size.
+template <typename T, typename TIndex, typename TValues, typename TActive>
+bool gatherInOrder(const Channel& order, const TValues& values, const ind numValues,
+                   const TActive& isActive, std::vector<std::pair<T, TIndex>>& sorted) {
+    if (order.size() != numValues) return false;
+    if (const auto* Order32 = dynamic_cast<const BufferChannel<int, 1>*>(&order))
+        return gatherInOrder(Order32->data().data(), values, numValues, isActive, sorted);
+    if (const auto* Order64 = dynamic_cast<const BufferChannel<ind, 1>*>(&order))
+        return gatherInOrder(Order64->data().data(), values, numValues, isActive, sorted);
+    return false;
+}
+
+}  // namespace percolation
+}  // namespace inviwo
@@ -0,0 +1,90 @@
+/*********************************************************************
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <percolation/percolationmoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <percolation/util/channelaccess.h>
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef __clang__
+#include <omp.h>
+#endif
+
+namespace inviwo {
+namespace percolation {
+
+/// Where excluded vertices come from
+enum class MaskSource {
+    /// Nothing is masked. -max sentinels are still cut off after sorting.
+    None,
+    /// NaN, +-inf and the -max sentinel written by ScalarTransform
+    NonFinite,
+    /// A separate channel, zero means excluded
+    Channel
+};
+
+/// Whether a scalar is an actual value, and not NaN, infinite or the lowest value as sentinel.
+template <typename T>
+bool isRegularValue(const T value) {
+    if (!std::is_floating_point<T>::value) return true;
+    return std::isfinite(static_cast<double>(value)) && value > std::numeric_limits<T>::lowest();
+}
+
+/// One byte per vertex, non-zero for vertices that take part in the sweep.
+using VertexMask = std::vector<unsigned char>;
+
+/// Reads a mask from any scalar channel. Non-zero values are active.
+template <typename T>
+std::shared_ptr<const VertexMask> createVertexMask(const DataChannel<T, 1>& channel) {
+    const ContiguousChannelData<T> Values(channel);
+    auto Mask = std::make_shared<VertexMask>(Values.size());
+#pragma omp parallel for
+    for (ind idx = 0; idx < Values.size(); ++idx) (*Mask)[idx] = (Values[idx] != T(0)) ? 1 : 0;
+    return Mask;
+}
+
+/** Writes (value, index) of all active vertices to active, in index order.
+    Blocks are counted and written in parallel, so inactive vertices cost one test each.
+*/
+template <typename T, typename TIndex, typename TValues, typename TActive>
+void gatherActiveValues(const TValues& values, const ind numValues, const TActive& isActive,
+                        std::vector<std::pair<T, TIndex>>& active) {
+    constexpr ind BlockSize = 1 << 16;
+    const ind NumBlocks = (numValues + BlockSize - 1) / BlockSize;
+
+    // Count per block, then offsets
+    std::vector<ind> Offsets(NumBlocks + 1, 0);
+#pragma omp parallel for schedule(dynamic)
+    for (ind block = 0; block < NumBlocks; ++block) {
+        const ind blockEnd = std::min(numValues, (block + 1) * BlockSize);
+        ind numActive = 0;
+        for (ind idx = block * BlockSize; idx < blockEnd; ++idx)
+            if (isActive(idx)) numActive++;
+        Offsets[block + 1] = numActive;
+    }
+    for (ind block = 0; block < NumBlocks; ++block) Offsets[block + 1] += Offsets[block];
+
+    active.resize(Offsets[NumBlocks]);
+#pragma omp parallel for schedule(dynamic)
+    for (ind block = 0; block < NumBlocks; ++block) {
+        const ind blockEnd = std::min(numValues, (block + 1) * BlockSize);
+        ind pos = Offsets[block];
+        for (ind idx = block * BlockSize; idx < blockEnd; ++idx)
+            if (isActive(idx)) active[pos++] = std::make_pair(values[idx], static_cast<TIndex>(idx));
+    }
+}
+
+}  // namespace percolation
+}  // namespace inviwo